@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,69 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts CHANNEL counting down from COUNT PIT cycles in mode 0,
+   "interrupt on terminal count": the channel's output drops to
+   0 immediately and rises to 1 once the count reaches zero, then
+   stays there until the channel is reprogrammed.  On channel 0
+   this yields a single timer interrupt COUNT cycles from now.
+
+   COUNT must be between 1 and 65535. */
+void
+pit_start_oneshot (int channel, unsigned count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0);
+  ASSERT (count > 0 && count <= UINT16_MAX);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30 | (0 << 1));
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the current value of CHANNEL's counter, that is, the
+   number of PIT cycles left before the end of the current period
+   (in mode 2) or countdown (in mode 0). */
+unsigned
+pit_read_counter (int channel)
+{
+  enum intr_level old_level;
+  unsigned count;
+
+  ASSERT (channel >= 0 && channel <= 2);
+
+  /* Latch the counter so that both bytes come from the same
+     instant, then read it back low byte first. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, channel << 6);
+  count = inb (PIT_PORT_COUNTER (channel));
+  count |= inb (PIT_PORT_COUNTER (channel)) << 8;
+  intr_set_level (old_level);
+
+  /* A count of 0 stands for 65536. */
+  return count != 0 ? count : 65536;
+}
+
+/* Returns true if CHANNEL's output is currently 1.  For a
+   channel started with pit_start_oneshot(), this means that the
+   countdown has finished. */
+bool
+pit_output_high (int channel)
+{
+  enum intr_level old_level;
+  uint8_t status;
+
+  ASSERT (channel >= 0 && channel <= 2);
+
+  /* Read-back command, latching only the status byte, whose top
+     bit is the state of the output pin. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xe0 | (2 << channel));
+  status = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  return (status & 0x80) != 0;
+}
@@ -1,5 +1,3 @@
-#include "threads/malloc.h"
-//needed for memory management of list items.
 #include "devices/timer.h"
 #include <debug.h>
 #include <list.h>
@@ -22,6 +20,25 @@
 
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
+
+/* If false (default), the timer interrupts TIMER_FREQ times per
+   second.
+   If true, the idle thread stops the periodic tick while no
+   thread is due to wake up.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT cycles in one timer tick. */
+#define PIT_TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Number of ticks covered by the pending one-shot countdown
+   started by timer_idle_enter(), or 0 if the timer is running
+   periodically. */
+static int64_t oneshot_ticks;
+
+/* Number of timer interrupts taken. */
+static int64_t timer_intrs;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -32,78 +49,64 @@ static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
 
-//cecils additions
-                             
-
-//alternate attempt
-/*
- Assume there is at most one reference to one thread being called at any given time.
- Assume that suspend_tick is called during the timer interrupt.
- */
-static struct list suspend_list;
-static void suspend_enque(int64_t wake_t);
-static void suspend_tick(void);
-
-static bool suspension_less( const struct list_elem *a,
-                             const struct list_elem *b,
-                             void *aux UNUSED){
-     struct thread* entry_a = list_entry(a, struct thread, elem);
-     struct thread* entry_b = list_entry(b, struct thread, elem);
-     if( (entry_a->wake_tm) < (entry_b->wake_tm) ){
-          return true;
-     }else{
-          return false;
-     }
-}                            
-
-static void suspend_tick(void){
-     
-     enum intr_level old_level = intr_disable ();//Disable interrupts so you can block the thread.
-     //ensure the list is empty
-     
-     if( list_empty(&suspend_list) ){
-          intr_set_level (old_level);//Re enable interrupts
-          return;
-     }          
-     
-     //if it is then declare data elements
-     struct list_elem* iter = list_begin(&suspend_list);
-     struct thread* entry = list_entry(iter, struct thread, elem);//get the entry
-                
-     //traverse the list
-     while( iter != list_end(&suspend_list) ){                
-                entry = list_entry(iter, struct thread, elem);//get the entry
-                //YOU MUST USE THE ABSOLUTE VALUE OF TICKS HERE
-                //I TRIED USING timer_ticks(), this does not work!
-                if ( entry->wake_tm <= ticks ){
-                              iter = list_remove(iter);//just this simple, iter now next element
-                              thread_unblock(entry);
-                     //since the list is in sorted order from min->max, this works
-                }else{
-                     intr_set_level(old_level);
-                     return;
-               }
-          }
-     intr_set_level(old_level);//Re-enable interrupts.
-}
-
-static void suspend_enque (int64_t wake_t){
-     enum intr_level old_level = intr_disable ();//Disable interrupts so you can block the thread.
-     //generate a new suspension element.
-     thread_current()->wake_tm =  wake_t + ticks;//using ticks because function proved unreliable.
-     //insert it into the list in ordered format.     
-     list_insert_ordered( &suspend_list, &(thread_current()->elem), &suspension_less, NULL);
-     thread_block();//has to be done now, if not fails
-     intr_set_level (old_level);//Re enable interrupts so you can block the thread.
-
-}
+/* Sleeping threads are kept in a hierarchical timing wheel, in
+   the style of the BSD callout wheel.  The root level has one
+   slot per tick for the next WHEEL_ROOT_SIZE ticks.  Each of the
+   WHEEL_LVL_CNT upper levels has WHEEL_LVL_SIZE slots, and each
+   of its slots spans the entire range of the level below.
+
+   Putting a thread to sleep is O(1): it is appended to the slot
+   that covers its wake time.  Each tick examines only the root
+   slot for that tick, and every thread found there is due.
+   Whenever the root level wraps around, the next slot of level
+   0 is "cascaded" by reinserting its threads into the root, and
+   likewise up the hierarchy, so each sleeping thread is moved at
+   most once per level. */
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_LVL_BITS 6
+#define WHEEL_LVL_CNT 4
+#define WHEEL_ROOT_SIZE (1 << WHEEL_ROOT_BITS)
+#define WHEEL_LVL_SIZE (1 << WHEEL_LVL_BITS)
+#define WHEEL_ROOT_MASK (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LVL_MASK (WHEEL_LVL_SIZE - 1)
+
+/* Longest sleep the wheel represents exactly, in ticks.  Longer
+   sleeps are parked in the last slot reachable and re-filed each
+   time that slot is cascaded. */
+#define WHEEL_SPAN ((int64_t) 1 << (WHEEL_ROOT_BITS \
+                                    + WHEEL_LVL_CNT * WHEEL_LVL_BITS))
+
+static struct list wheel_root[WHEEL_ROOT_SIZE];
+static struct list wheel_lvl[WHEEL_LVL_CNT][WHEEL_LVL_SIZE];
+
+/* Next tick whose root slot has not yet been expired. */
+static int64_t wheel_tick;
+
+/* Statistics. */
+static unsigned sleeper_cnt;       /* # of threads in the wheel. */
+static uint64_t max_intr_off;      /* Longest wheel operation, in cycles. */
+
+static void timer_advance (int64_t cnt);
+static void suspend_enque (int64_t duration);
+static void suspend_tick (void);
+static int64_t wheel_idle_ticks (int64_t max);
+static void wheel_insert (struct thread *);
+static void wheel_cascade (struct list *slot);
+static void note_intr_off (uint64_t start);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
-  list_init( &suspend_list);
+  size_t i, j;
+
+  for (i = 0; i < WHEEL_ROOT_SIZE; i++)
+    list_init (&wheel_root[i]);
+  for (i = 0; i < WHEEL_LVL_CNT; i++)
+    for (j = 0; j < WHEEL_LVL_SIZE; j++)
+      list_init (&wheel_lvl[i][j]);
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -158,10 +161,11 @@ timer_elapsed (int64_t then)
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
-  if( ticks <= 0){ return ;}
+  if (ticks <= 0)
+    return;
+
   ASSERT (intr_get_level () == INTR_ON);
-  suspend_enque(ticks);
+  suspend_enque (ticks);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -227,22 +231,291 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  In tickless mode, replaces the periodic tick by
+   a single countdown that ends at the first tick on which some
+   sleeping thread is due, or as far ahead as the PIT's 16-bit
+   counter can reach, whichever is sooner. */
+void
+timer_idle_enter (void)
+{
+  unsigned count;
+  int64_t skip;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || oneshot_ticks > 0)
+    return;
+
+  /* COUNT is what is left of the current tick.  Extend it by
+     whole ticks in which nothing would happen. */
+  count = pit_read_counter (0);
+  if (count > PIT_TICK_COUNT)
+    return;
+  skip = wheel_idle_ticks ((UINT16_MAX - count) / PIT_TICK_COUNT);
+  if (skip == 0)
+    return;
+
+  pit_start_oneshot (0, count + skip * PIT_TICK_COUNT);
+  oneshot_ticks = skip + 1;
+}
+
+/* Called by the idle thread after the CPU wakes up from a halt.
+   If an interrupt other than the timer's woke us before the
+   countdown started by timer_idle_enter() finished, catches the
+   clock up on the ticks that have already passed and resumes
+   ticking in phase with the old tick boundaries. */
+void
+timer_idle_exit (void)
+{
+  enum intr_level old_level;
+  unsigned count;
+  int64_t left;
+
+  old_level = intr_disable ();
+
+  /* If the countdown has finished, its interrupt is pending and
+     timer_interrupt() will do the catching up. */
+  if (oneshot_ticks > 0 && !pit_output_high (0))
+    {
+      count = pit_read_counter (0);
+      left = DIV_ROUND_UP (count, PIT_TICK_COUNT);
+
+      /* Finish off the partial tick with a one-tick countdown,
+         after which timer_interrupt() restores the periodic
+         tick. */
+      pit_start_oneshot (0, (count - 1) % PIT_TICK_COUNT + 1);
+      timer_advance (oneshot_ticks - left);
+      oneshot_ticks = 1;
+    }
+
+  intr_set_level (old_level);
+}
+
+/* Returns the processor's time-stamp counter, a free-running
+   count of CPU clock cycles.  Useful for timing intervals much
+   shorter than a timer tick. */
+uint64_t
+timer_cycles (void)
+{
+  uint64_t tsc;
+
+  /* See [IA32-v2b] "RDTSC". */
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Returns the longest time, in cycles as counted by
+   timer_cycles(), that interrupts have been kept off to update
+   the sleep queue since boot or the last call to
+   timer_reset_sleep_stats(). */
+uint64_t
+timer_max_sleep_cycles (void)
+{
+  enum intr_level old_level = intr_disable ();
+  uint64_t max = max_intr_off;
+  intr_set_level (old_level);
+  return max;
+}
+
+/* Resets the statistic reported by timer_max_sleep_cycles(). */
+void
+timer_reset_sleep_stats (void)
+{
+  enum intr_level old_level = intr_disable ();
+  max_intr_off = 0;
+  intr_set_level (old_level);
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) 
 {
-  printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  printf ("Timer: %"PRId64" ticks, %"PRId64" interrupts, %u sleeping, "
+          "%"PRIu64" cycles max sleep-queue latency\n",
+          timer_ticks (), timer_intrs, sleeper_cnt, max_intr_off);
 }
-// 
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-     //enum intr_level old_level = intr_disable();
-  ticks++;
-  thread_tick ();
-  suspend_tick();
-     //intr_set_level(old_level);
+  timer_intrs++;
+
+  /* While a countdown is pending, an interrupt with the output
+     still low is a periodic tick that was already raised when
+     timer_idle_enter() reprogrammed the PIT. */
+  if (oneshot_ticks > 0 && pit_output_high (0))
+    {
+      int64_t cnt = oneshot_ticks;
+
+      oneshot_ticks = 0;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+      timer_advance (cnt);
+    }
+  else
+    timer_advance (1);
+}
+
+/* Advances the clock by CNT ticks, doing the work of each one in
+   turn.  Interrupts must be off. */
+static void
+timer_advance (int64_t cnt)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (cnt-- > 0)
+    {
+      ticks++;
+      thread_tick ();
+      suspend_tick ();
+    }
+}
+
+/* Puts the running thread to sleep until DURATION timer ticks
+   from now. */
+static void
+suspend_enque (int64_t duration)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  uint64_t start;
+
+  old_level = intr_disable ();
+  start = timer_cycles ();
+  cur->wake_tm = ticks + duration;
+  wheel_insert (cur);
+  sleeper_cnt++;
+  note_intr_off (start);
+
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Wakes up every sleeping thread whose wake time has arrived.
+   Called once per tick, with interrupts off. */
+static void
+suspend_tick (void)
+{
+  uint64_t start;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  start = timer_cycles ();
+  while (wheel_tick <= ticks)
+    {
+      int index = wheel_tick & WHEEL_ROOT_MASK;
+      struct list *slot = &wheel_root[index];
+
+      /* On wrap-around of each level, refill it from the next
+         slot of the level above. */
+      if (index == 0)
+        {
+          int shift = WHEEL_ROOT_BITS;
+          int lvl;
+
+          for (lvl = 0; lvl < WHEEL_LVL_CNT; lvl++)
+            {
+              int lvl_index = (wheel_tick >> shift) & WHEEL_LVL_MASK;
+              wheel_cascade (&wheel_lvl[lvl][lvl_index]);
+              if (lvl_index != 0)
+                break;
+              shift += WHEEL_LVL_BITS;
+            }
+        }
+      wheel_tick++;
+
+      while (!list_empty (slot))
+        {
+          struct list_elem *e = list_pop_front (slot);
+          thread_unblock (list_entry (e, struct thread, elem));
+          sleeper_cnt--;
+        }
+    }
+  note_intr_off (start);
+}
+
+/* Files sleeping thread T in the wheel slot that covers its wake
+   time.  Interrupts must be off. */
+static void
+wheel_insert (struct thread *t)
+{
+  int64_t expires = t->wake_tm;
+  int64_t delta = expires - wheel_tick;
+  struct list *slot;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (delta < 0)
+    {
+      /* Already due.  Wake it on the next tick processed. */
+      slot = &wheel_root[wheel_tick & WHEEL_ROOT_MASK];
+    }
+  else if (delta < WHEEL_ROOT_SIZE)
+    slot = &wheel_root[expires & WHEEL_ROOT_MASK];
+  else
+    {
+      int shift = WHEEL_ROOT_BITS;
+      int lvl = 0;
+
+      if (delta >= WHEEL_SPAN)
+        {
+          delta = WHEEL_SPAN - 1;
+          expires = wheel_tick + delta;
+        }
+      while (delta >= (int64_t) 1 << (shift + WHEEL_LVL_BITS))
+        {
+          shift += WHEEL_LVL_BITS;
+          lvl++;
+        }
+      slot = &wheel_lvl[lvl][(expires >> shift) & WHEEL_LVL_MASK];
+    }
+  list_push_back (slot, &t->elem);
+}
+
+/* Returns the number of upcoming ticks, starting with the next
+   one and up to MAX, that have nothing to wake or cascade. */
+static int64_t
+wheel_idle_ticks (int64_t max)
+{
+  int64_t cnt;
+
+  for (cnt = 0; cnt < max; cnt++)
+    {
+      int index = (wheel_tick + cnt) & WHEEL_ROOT_MASK;
+      if (index == 0 || !list_empty (&wheel_root[index]))
+        break;
+    }
+  return cnt;
+}
+
+/* Empties SLOT by refiling each of its threads relative to the
+   current wheel position. */
+static void
+wheel_cascade (struct list *slot)
+{
+  struct list pending;
+
+  if (list_empty (slot))
+    return;
+
+  /* Detach the slot first, because a thread that sleeps longer
+     than WHEEL_SPAN may be filed right back into it. */
+  list_init (&pending);
+  list_splice (list_end (&pending), list_begin (slot), list_end (slot));
+  while (!list_empty (&pending))
+    wheel_insert (list_entry (list_pop_front (&pending),
+                              struct thread, elem));
+}
+
+/* Records an interrupts-off interval that began at START, as
+   returned by timer_cycles(). */
+static void
+note_intr_off (uint64_t start)
+{
+  uint64_t elapsed = timer_cycles () - start;
+  if (elapsed > max_intr_off)
+    max_intr_off = elapsed;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
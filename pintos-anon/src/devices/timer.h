@@ -2,12 +2,16 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
-
+/* If false (default), tick TIMER_FREQ times per second.
+   If true, stop the tick while idle with nothing due.
+   Controlled by kernel command-line option "-tickless". */
+extern bool timer_tickless;
 
 void timer_init (void);
 void timer_calibrate (void);
@@ -26,6 +30,15 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* Tickless idle. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+/* Cycle counting. */
+uint64_t timer_cycles (void);
+uint64_t timer_max_sleep_cycles (void);
+void timer_reset_sleep_stats (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
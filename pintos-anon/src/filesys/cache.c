@@ -0,0 +1,786 @@
+#include "filesys/cache.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* Buffer cache.
+
+   Holds up to cache_size sectors of the file system device in
+   memory.  Reads are satisfied from the cache when possible, and
+   writes only dirty the cached copy, which is written back to
+   disk when its entry is evicted, by a "write-behind" thread that
+   flushes the whole cache periodically, and by cache_flush().
+   Entries are evicted in clock order, skipping those accessed
+   since the hand last passed them.
+
+   A separate "read-ahead" thread loads sectors that the file
+   system expects to need soon, so that the disk reads them while
+   the requester is busy with the sectors it already has.
+
+   Both threads move runs of consecutive sectors to and from
+   disk with one multi-sector transfer each, and so does
+   cache_read_run(), which file reads use for sectors that are
+   consecutive on disk.  A thread may hold
+   the data locks of several entries at once only if it acquires
+   them in increasing order of sector, or if nobody else can be
+   holding them, as for entries it has just evicted.
+
+   Each entry has a lock that is held for as long as its data is
+   being read, written, or transferred to or from disk.  The
+   cache's global lock only protects the map from sectors to
+   entries and the bookkeeping needed for eviction, so threads
+   using different sectors proceed in parallel even while one of
+   them waits for the disk.  An entry whose pin count is nonzero
+   is in use, or about to be, and cannot be evicted.
+
+   Evicting a dirty entry means writing its old contents back
+   before reading new ones in.  Until the write completes, the
+   old sector is not in the map, so anyone looking for it must
+   wait, lest they read stale data from disk.  A second map, from
+   old sector to entry, tells them so without a search.
+
+   A sector written with cache_write_logged_at() belongs to a
+   journal transaction that has not yet committed.  It must not
+   reach its place on disk before the transaction is in the
+   journal, so it is neither evicted nor flushed until the
+   journal calls cache_unlog() for it. */
+
+/* A cached sector. */
+struct cache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in `cache_map'. */
+    struct hash_elem writeback_elem;    /* Element in `writeback_map'. */
+    block_sector_t sector;              /* Sector cached, or INVALID_SECTOR. */
+    block_sector_t old_sector;          /* Dirty sector to write back
+                                           first, or INVALID_SECTOR. */
+    bool valid;                         /* Data read in? */
+    bool dirty;                         /* Data changed since read? */
+    bool accessed;                      /* Used since clock hand passed? */
+    bool logged;                        /* Held for the journal? */
+    int pin_cnt;                        /* Number of users. */
+    struct lock data_lock;              /* Protects data, valid, dirty. */
+    uint8_t *data;                      /* BLOCK_SECTOR_SIZE bytes. */
+  };
+
+/* Marks an entry that does not hold a sector. */
+#define INVALID_SECTOR ((block_sector_t) -1)
+
+/* Number of sectors in the buffer cache. */
+size_t cache_size = 64;
+
+static struct cache_entry *entries;     /* All entries. */
+static struct hash cache_map;           /* Map from sector to entry. */
+static size_t clock_hand;               /* Next eviction candidate. */
+static struct hash writeback_map;       /* Map from `old_sector' to entry. */
+static struct lock cache_lock;          /* Protects the above. */
+static struct condition cache_cond;     /* Signaled when an entry is
+                                           unpinned or written back. */
+
+/* Most sectors transferred to or from disk at once. */
+#define RUN_MAX 32
+
+/* Flushing. */
+static struct cache_entry **flush_entries; /* Entries to flush. */
+static struct lock flush_lock;          /* One flush at a time. */
+
+/* Ticks between write-behind flushes. */
+#define WRITE_BEHIND_TICKS TIMER_FREQ
+
+/* Sectors waiting to be read ahead, in a ring buffer. */
+#define READAHEAD_MAX 64                /* Must be a power of 2. */
+static block_sector_t readahead_queue[READAHEAD_MAX];
+static unsigned readahead_head;         /* Next slot to fill. */
+static unsigned readahead_tail;         /* Next slot to read ahead. */
+static struct lock readahead_lock;      /* Protects the queue. */
+static struct condition readahead_cond; /* Signaled when nonempty. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Lookups found in cache. */
+static long long miss_cnt;              /* Lookups not found. */
+static long long readahead_cnt;         /* Sectors queued for read-ahead. */
+
+static struct cache_entry *cache_get (block_sector_t, bool read);
+static struct cache_entry *cache_get_new (block_sector_t);
+static void cache_put (struct cache_entry *, bool dirty);
+static void write_at (block_sector_t, const void *, size_t ofs, size_t size,
+                      bool logged);
+static void flush (const struct bitmap *);
+static void finish_writeback (struct cache_entry *);
+static void write_run (struct cache_entry *[], size_t cnt);
+static void read_run (block_sector_t, size_t cnt);
+static struct cache_entry *lookup (block_sector_t);
+static struct cache_entry *evict (void);
+static bool writing_back (block_sector_t);
+static thread_func write_behind_thread;
+static thread_func readahead_thread;
+static hash_hash_func entry_hash;
+static hash_less_func entry_less;
+static hash_hash_func writeback_hash;
+static hash_less_func writeback_less;
+static int compare_entries (const void *, const void *);
+
+/* Initializes the buffer cache and starts its threads. */
+void
+cache_init (void)
+{
+  size_t page_cnt = DIV_ROUND_UP (cache_size * BLOCK_SECTOR_SIZE, PGSIZE);
+  uint8_t *data;
+  size_t i;
+
+  ASSERT (cache_size > 0);
+
+  entries = malloc (cache_size * sizeof *entries);
+  flush_entries = malloc (cache_size * sizeof *flush_entries);
+  data = palloc_get_multiple (0, page_cnt);
+  if (entries == NULL || flush_entries == NULL || data == NULL
+      || !hash_init (&cache_map, entry_hash, entry_less, NULL)
+      || !hash_init (&writeback_map, writeback_hash, writeback_less, NULL))
+    PANIC ("Not enough memory for a %zu-sector buffer cache.", cache_size);
+
+  for (i = 0; i < cache_size; i++)
+    {
+      struct cache_entry *e = &entries[i];
+
+      e->sector = e->old_sector = INVALID_SECTOR;
+      e->valid = e->dirty = e->accessed = e->logged = false;
+      e->pin_cnt = 0;
+      lock_init (&e->data_lock);
+      e->data = data + i * BLOCK_SECTOR_SIZE;
+    }
+  clock_hand = 0;
+  lock_init (&cache_lock);
+  cond_init (&cache_cond);
+  lock_init (&flush_lock);
+
+  readahead_head = readahead_tail = 0;
+  lock_init (&readahead_lock);
+  cond_init (&readahead_cond);
+
+  thread_create ("write-behind", PRI_DEFAULT, write_behind_thread, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, readahead_thread, NULL);
+}
+
+/* Writes every dirty sector in the cache to disk, except those
+   held for the journal.  Goes through the sectors in order, so
+   that consecutive ones reach the disk together. */
+void
+cache_flush (void)
+{
+  flush (NULL);
+}
+
+/* Writes the dirty sectors in the cache whose bits are set in
+   SECTORS, which has a bit for each sector of the file system
+   device, like cache_flush().  Waits for any of them that is
+   already being written back. */
+void
+cache_flush_sectors (const struct bitmap *sectors)
+{
+  flush (sectors);
+}
+
+/* Writes every dirty sector in the cache to disk, like
+   cache_flush(), then drops every sector that is clean and not
+   in use, so that the next access to it goes to the disk.  For
+   measuring the file system with a cold cache. */
+void
+cache_discard (void)
+{
+  size_t i;
+
+  flush (NULL);
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cache_size; i++)
+    {
+      struct cache_entry *e = &entries[i];
+
+      /* Nobody else can hold the lock of an unpinned entry. */
+      if (e->sector != INVALID_SECTOR && e->pin_cnt == 0 && !e->dirty
+          && !e->logged && e->old_sector == INVALID_SECTOR)
+        {
+          hash_delete (&cache_map, &e->hash_elem);
+          e->sector = INVALID_SECTOR;
+          e->valid = e->accessed = false;
+        }
+    }
+  lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  long long lookups = hit_cnt + miss_cnt;
+
+  printf ("Cache: %lld hits, %lld misses (%lld%% hit rate), "
+          "%lld sectors read ahead\n",
+          hit_cnt, miss_cnt, lookups > 0 ? hit_cnt * 100 / lookups : 0,
+          readahead_cnt);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte OFS within SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e, false);
+}
+
+/* Writes BUFFER, which must contain BLOCK_SECTOR_SIZE bytes, to
+   SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR, starting at byte OFS
+   within it.  The rest of the sector is read from disk first
+   unless it is already cached. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size)
+{
+  write_at (sector, buffer, ofs, size, false);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR, starting at byte OFS
+   within it, like cache_write_at(), and keeps SECTOR in the
+   cache, unwritten, until cache_unlog() is called for it. */
+void
+cache_write_logged_at (block_sector_t sector, const void *buffer,
+                       size_t ofs, size_t size)
+{
+  write_at (sector, buffer, ofs, size, true);
+}
+
+/* Allows SECTOR, written with cache_write_logged_at(), to be
+   written back and evicted again. */
+void
+cache_unlog (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = lookup (sector);
+  ASSERT (e != NULL && e->logged);
+  e->logged = false;
+  cond_broadcast (&cache_cond, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Fills SECTOR with zeros, without reading it from disk. */
+void
+cache_zero (block_sector_t sector)
+{
+  struct cache_entry *e = cache_get (sector, false);
+  memset (e->data, 0, BLOCK_SECTOR_SIZE);
+  cache_put (e, true);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache, if
+   it is not there already.  Does not wait for it to happen. */
+void
+cache_readahead (block_sector_t sector)
+{
+  bool cached;
+
+  lock_acquire (&cache_lock);
+  cached = lookup (sector) != NULL;
+  lock_release (&cache_lock);
+  if (cached)
+    return;
+
+  /* If the queue is full, the thread is far enough behind that
+     this request would be useless by the time it got to it. */
+  lock_acquire (&readahead_lock);
+  if (readahead_head - readahead_tail < READAHEAD_MAX)
+    {
+      readahead_queue[readahead_head++ % READAHEAD_MAX] = sector;
+      readahead_cnt++;
+      cond_signal (&readahead_cond, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Returns the most sectors that cache_read_run() reads at once:
+   no more than one transfer's worth, and no more than a quarter
+   of the cache, so that a run does not evict what it has just
+   read. */
+size_t
+cache_run_max (void)
+{
+  size_t max_cnt = cache_size / 4 < RUN_MAX ? cache_size / 4 : RUN_MAX;
+  return max_cnt > 0 ? max_cnt : 1;
+}
+
+/* Reads those of the CNT sectors starting at SECTOR that are not
+   cached into the cache, with one transfer per run of
+   consecutive sectors missing from it, and waits for them.  CNT
+   must not exceed cache_run_max(). */
+void
+cache_read_run (block_sector_t sector, size_t cnt)
+{
+  ASSERT (cnt <= cache_run_max ());
+  read_run (sector, cnt);
+}
+
+/* Returns the cached contents of SECTOR, reading it in first if
+   necessary, so that the caller can read it in place instead of
+   copying it out with cache_read_at().  Stores the entry that
+   holds it in *EP, which the caller must pass to
+   cache_end_read() when done.  Until then, the entry is locked,
+   so the caller must not use the buffer cache otherwise. */
+const void *
+cache_begin_read (block_sector_t sector, struct cache_entry **ep)
+{
+  *ep = cache_get (sector, true);
+  return (*ep)->data;
+}
+
+/* Releases entry E, obtained with cache_begin_read(). */
+void
+cache_end_read (struct cache_entry *e)
+{
+  cache_put (e, false);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR, starting at byte OFS
+   within it, reading the rest of the sector from disk first
+   unless it is already cached.  If LOGGED is true, holds SECTOR
+   for the journal. */
+static void
+write_at (block_sector_t sector, const void *buffer, size_t ofs, size_t size,
+          bool logged)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  if (logged)
+    {
+      lock_acquire (&cache_lock);
+      e->logged = true;
+      lock_release (&cache_lock);
+    }
+  cache_put (e, true);
+}
+
+/* Returns the entry for SECTOR, pinned, with its data lock held.
+   Unless READ is false, in which case the caller must overwrite
+   the entire sector, the entry's data is the sector's
+   contents. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector != INVALID_SECTOR);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      if (!writing_back (sector))
+        {
+          e = lookup (sector);
+          if (e != NULL)
+            {
+              hit_cnt++;
+              break;
+            }
+
+          e = evict ();
+          if (e != NULL)
+            {
+              miss_cnt++;
+              e->sector = sector;
+              e->valid = false;
+              hash_insert (&cache_map, &e->hash_elem);
+              break;
+            }
+        }
+
+      /* Wait for SECTOR's write-back, or for some entry to be
+         unpinned, then try again. */
+      cond_wait (&cache_cond, &cache_lock);
+    }
+  e->pin_cnt++;
+  e->accessed = true;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->data_lock);
+  finish_writeback (e);
+  if (!e->valid)
+    {
+      if (read)
+        block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* Returns a newly evicted entry for SECTOR, pinned, with its
+   data lock held and its data not yet read in.  Returns a null
+   pointer, without waiting, if SECTOR is already cached or
+   being written back, or if every entry is pinned. */
+static struct cache_entry *
+cache_get_new (block_sector_t sector)
+{
+  struct cache_entry *e = NULL;
+
+  ASSERT (sector != INVALID_SECTOR);
+
+  lock_acquire (&cache_lock);
+  if (!writing_back (sector) && lookup (sector) == NULL)
+    {
+      e = evict ();
+      if (e != NULL)
+        {
+          miss_cnt++;
+          e->sector = sector;
+          e->valid = false;
+          hash_insert (&cache_map, &e->hash_elem);
+          e->pin_cnt++;
+          e->accessed = true;
+        }
+    }
+  lock_release (&cache_lock);
+
+  /* Nobody else can hold the lock of an unpinned entry. */
+  if (e != NULL)
+    {
+      lock_acquire (&e->data_lock);
+      finish_writeback (e);
+    }
+  return e;
+}
+
+/* Releases entry E, obtained with cache_get(), marking it dirty
+   if DIRTY is true. */
+static void
+cache_put (struct cache_entry *e, bool dirty)
+{
+  if (dirty)
+    e->dirty = true;
+  lock_release (&e->data_lock);
+
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_broadcast (&cache_cond, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes the dirty sectors in the cache whose bits are set in
+   SECTORS, or all of them if SECTORS is a null pointer, for
+   cache_flush() and cache_flush_sectors(). */
+static void
+flush (const struct bitmap *sectors)
+{
+  struct cache_entry *run[RUN_MAX];
+  size_t run_cnt = 0;
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&flush_lock);
+
+  /* Pin every entry with something to write, so that none of
+     them is evicted before we get to it. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cache_size; i++)
+    {
+      struct cache_entry *e = &entries[i];
+
+      if (e->sector != INVALID_SECTOR
+          && ((e->dirty
+               && (sectors == NULL || bitmap_test (sectors, e->sector)))
+              || (e->old_sector != INVALID_SECTOR
+                  && (sectors == NULL
+                      || bitmap_test (sectors, e->old_sector)))))
+        {
+          e->pin_cnt++;
+          flush_entries[cnt++] = e;
+        }
+    }
+  lock_release (&cache_lock);
+  qsort (flush_entries, cnt, sizeof *flush_entries, compare_entries);
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = flush_entries[i];
+
+      lock_acquire (&e->data_lock);
+      finish_writeback (e);
+      if (e->valid && e->dirty && !e->logged)
+        {
+          if (run_cnt > 0
+              && (run_cnt == RUN_MAX || e->sector != run[0]->sector + run_cnt))
+            {
+              write_run (run, run_cnt);
+              run_cnt = 0;
+            }
+          run[run_cnt++] = e;
+        }
+      else
+        cache_put (e, false);
+    }
+  if (run_cnt > 0)
+    write_run (run, run_cnt);
+
+  lock_release (&flush_lock);
+}
+
+/* If E was evicted while dirty, writes its old contents back.
+   E's data lock must be held. */
+static void
+finish_writeback (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->data_lock));
+
+  if (e->old_sector == INVALID_SECTOR)
+    return;
+
+  block_write (fs_device, e->old_sector, e->data);
+
+  lock_acquire (&cache_lock);
+  hash_delete (&writeback_map, &e->writeback_elem);
+  e->old_sector = INVALID_SECTOR;
+  cond_broadcast (&cache_cond, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes the CNT entries in RUN, which must be dirty, locked,
+   and cache consecutive sectors, to disk with one transfer and
+   releases them. */
+static void
+write_run (struct cache_entry *run[], size_t cnt)
+{
+  const void *buffers[RUN_MAX];
+  size_t i;
+
+  ASSERT (cnt <= RUN_MAX);
+
+  for (i = 0; i < cnt; i++)
+    buffers[i] = run[i]->data;
+  block_write_multiple (fs_device, run[0]->sector, cnt, buffers);
+  for (i = 0; i < cnt; i++)
+    {
+      run[i]->dirty = false;
+      cache_put (run[i], false);
+    }
+}
+
+/* Reads as many of the CNT sectors starting at SECTOR into the
+   cache as are not there already, with one transfer per run of
+   consecutive sectors missing from it. */
+static void
+read_run (block_sector_t sector, size_t cnt)
+{
+  struct cache_entry *run[RUN_MAX];
+  void *buffers[RUN_MAX];
+  size_t run_cnt = 0;
+  size_t i;
+
+  ASSERT (cnt <= RUN_MAX);
+
+  for (i = 0; i <= cnt; i++)
+    {
+      struct cache_entry *e = i < cnt ? cache_get_new (sector + i) : NULL;
+
+      if (e != NULL)
+        {
+          run[run_cnt] = e;
+          buffers[run_cnt++] = e->data;
+        }
+      else if (run_cnt > 0)
+        {
+          size_t j;
+
+          block_read_multiple (fs_device, run[0]->sector, run_cnt, buffers);
+          for (j = 0; j < run_cnt; j++)
+            {
+              run[j]->valid = true;
+              cache_put (run[j], false);
+            }
+          run_cnt = 0;
+        }
+    }
+}
+
+/* Returns the entry for SECTOR, or a null pointer if SECTOR is
+   not cached.  The cache lock must be held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  struct cache_entry key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&cache_map, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_entry, hash_elem) : NULL;
+}
+
+/* Chooses an unpinned entry, removes it from the map, and
+   returns it.  If it was dirty, arranges for the next user to
+   write it back.  Returns a null pointer if every entry is
+   pinned.  The cache lock must be held. */
+static struct cache_entry *
+evict (void)
+{
+  size_t i;
+
+  /* Two passes suffice: the first clears every accessed bit. */
+  for (i = 0; i < 2 * cache_size; i++)
+    {
+      struct cache_entry *e = &entries[clock_hand];
+
+      clock_hand = (clock_hand + 1) % cache_size;
+      if (e->pin_cnt > 0 || e->logged)
+        continue;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+
+      if (e->sector != INVALID_SECTOR)
+        {
+          hash_delete (&cache_map, &e->hash_elem);
+          if (e->dirty)
+            {
+              ASSERT (e->old_sector == INVALID_SECTOR);
+              e->old_sector = e->sector;
+              e->dirty = false;
+              hash_insert (&writeback_map, &e->writeback_elem);
+            }
+        }
+      return e;
+    }
+  return NULL;
+}
+
+/* Returns true if SECTOR's old contents are waiting to be
+   written back from an evicted entry.  The cache lock must be
+   held. */
+static bool
+writing_back (block_sector_t sector)
+{
+  struct cache_entry key;
+
+  key.old_sector = sector;
+  return hash_find (&writeback_map, &key.writeback_elem) != NULL;
+}
+
+/* Flushes the cache every WRITE_BEHIND_TICKS timer ticks, so that
+   little is lost if the machine crashes. */
+static void
+write_behind_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITE_BEHIND_TICKS);
+      cache_flush ();
+    }
+}
+
+/* Reads the sectors in the read-ahead queue into the cache,
+   taking consecutive requests for consecutive sectors together. */
+static void
+readahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      size_t max_cnt = cache_run_max ();
+      block_sector_t sector;
+      size_t cnt;
+
+      lock_acquire (&readahead_lock);
+      while (readahead_head == readahead_tail)
+        cond_wait (&readahead_cond, &readahead_lock);
+      sector = readahead_queue[readahead_tail++ % READAHEAD_MAX];
+      for (cnt = 1; cnt < max_cnt && readahead_head != readahead_tail; cnt++)
+        {
+          if (readahead_queue[readahead_tail % READAHEAD_MAX] != sector + cnt)
+            break;
+          readahead_tail++;
+        }
+      lock_release (&readahead_lock);
+
+      read_run (sector, cnt);
+    }
+}
+
+/* Returns a hash value for the entry containing hash element E. */
+static unsigned
+entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct cache_entry, hash_elem)->sector);
+}
+
+/* Compares the sectors cached by the entries that A and B,
+   elements of `flush_entries', point to, for qsort(). */
+static int
+compare_entries (const void *a_, const void *b_)
+{
+  const struct cache_entry *a = *(struct cache_entry *const *) a_;
+  const struct cache_entry *b = *(struct cache_entry *const *) b_;
+
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Returns true if the entry containing hash element A caches a
+   lower sector than the one containing B. */
+static bool
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct cache_entry, hash_elem)->sector
+          < hash_entry (b, struct cache_entry, hash_elem)->sector);
+}
+
+/* Returns a hash value for the entry containing hash element E
+   of `writeback_map'. */
+static unsigned
+writeback_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct cache_entry,
+                               writeback_elem)->old_sector);
+}
+
+/* Returns true if the entry containing hash element A of
+   `writeback_map' has a lower old sector than the one containing
+   B. */
+static bool
+writeback_less (const struct hash_elem *a, const struct hash_elem *b,
+                void *aux UNUSED)
+{
+  return (hash_entry (a, struct cache_entry, writeback_elem)->old_sector
+          < hash_entry (b, struct cache_entry, writeback_elem)->old_sector);
+}
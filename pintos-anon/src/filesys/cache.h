@@ -0,0 +1,34 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+struct bitmap;
+struct cache_entry;
+
+/* Number of sectors in the buffer cache.
+   Controlled by kernel command-line option "-cache=SECTORS". */
+extern size_t cache_size;
+
+void cache_init (void);
+void cache_flush (void);
+void cache_flush_sectors (const struct bitmap *);
+void cache_discard (void);
+void cache_print_stats (void);
+
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, size_t ofs, size_t size);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void cache_write_logged_at (block_sector_t, const void *,
+                            size_t ofs, size_t size);
+void cache_unlog (block_sector_t);
+void cache_zero (block_sector_t);
+void cache_readahead (block_sector_t);
+size_t cache_run_max (void);
+void cache_read_run (block_sector_t, size_t cnt);
+const void *cache_begin_read (block_sector_t, struct cache_entry **);
+void cache_end_read (struct cache_entry *);
+
+#endif /* filesys/cache.h */
@@ -1,16 +1,21 @@
 #include "filesys/directory.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    struct inode *index;                /* Hash index, if open. */
   };
 
 /* A single directory entry. */
@@ -21,12 +26,122 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* A directory is an array of `struct dir_entry's, the first of
+   which is replaced by a `struct dir_header'.  The header
+   locates a hash index of the directory's entries, so that
+   looking up, adding, and removing a name takes a constant
+   number of sector reads instead of a scan of the whole
+   directory.  File system images from before the index, whose
+   directories have no header, are not supported: their inodes
+   are laid out differently too, so inode_open() rejects them.
+
+   The index is a separate inode that holds a `struct
+   index_header' followed by an open-addressed hash table of
+   `struct index_slot's, probed linearly from hash_string() of
+   the name.  When it becomes three-quarters full, counting
+   deleted slots, it is replaced by a new index twice as large,
+   built from the directory's entries.
+
+   Free entries in an indexed directory are linked into a list
+   through their `inode_sector' members, so that adding a name
+   need not search for one either.
+
+   Adding and removing names holds the directory inode's
+   inode_dir_lock() for writing, and looking one up holds it for
+   reading, so that a lookup sees each change completely or not
+   at all and cannot open a file that is being removed.  Reading
+   entries in order with dir_readdir() takes no lock, because it
+   reads only one entry at a time. */
+
+/* Identifies a directory with a hash index. */
+#define DIR_MAGIC 0x48534944
+
+/* First entry of a directory with a hash index.  `in_use' is
+   always false, so that code that reads the entries in order
+   skips it. */
+struct dir_header
+  {
+    block_sector_t index_sector;        /* Index's inode, or 0 if none. */
+    unsigned magic;                     /* Always DIR_MAGIC. */
+    off_t free_ofs;                     /* First free entry, or 0. */
+    char unused[NAME_MAX + 1 - 2 * sizeof (off_t)];
+    bool in_use;                        /* Always false. */
+  };
+
+/* Start of a hash index. */
+struct index_header
+  {
+    uint32_t live_cnt;                  /* Slots that locate an entry. */
+    uint32_t used_cnt;                  /* Slots not empty. */
+  };
+
+/* A slot in a hash index. */
+struct index_slot
+  {
+    uint32_t hash;                      /* Hash of entry's name. */
+    off_t ofs;                          /* Offset of entry in directory,
+                                           or SLOT_EMPTY or SLOT_DELETED. */
+  };
+
+/* Values of `ofs' in slots that do not locate an entry.  Offset
+   0 holds the directory's header, so it is never an entry. */
+#define SLOT_EMPTY 0
+#define SLOT_DELETED ((off_t) -1)
+
+/* No slot. */
+#define NO_SLOT UINT32_MAX
+
+/* Smallest number of slots in an index. */
+#define MIN_SLOTS 64
+
+/* Cache of `struct dir's. */
+static struct kmem_cache *dir_cache;
+
+/* Initializes the directory module. */
+void
+dir_init (void) 
+{
+  ASSERT (sizeof (struct dir_header) == sizeof (struct dir_entry));
+  ASSERT (sizeof (struct index_header) == sizeof (struct index_slot));
+  dir_cache = kmem_cache_create ("dir", sizeof (struct dir), 0, NULL);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header h;
+  struct inode *inode;
+  bool success = true;
+  size_t i;
+
+  if (!inode_create (sector, (entry_cnt + 1) * sizeof (struct dir_entry)))
+    return false;
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  inode_set_metadata (inode);
+
+  /* Put the initial entries on the free list. */
+  for (i = 1; i <= entry_cnt; i++)
+    {
+      struct dir_entry e;
+
+      memset (&e, 0, sizeof e);
+      e.inode_sector = i < entry_cnt ? (i + 1) * sizeof e : 0;
+      if (inode_write_at (inode, &e, sizeof e, i * sizeof e) != sizeof e)
+        success = false;
+    }
+
+  memset (&h, 0, sizeof h);
+  h.magic = DIR_MAGIC;
+  h.free_ofs = entry_cnt > 0 ? sizeof (struct dir_entry) : 0;
+  if (inode_write_at (inode, &h, sizeof h, 0) != sizeof h)
+    success = false;
+
+  inode_close (inode);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -34,17 +149,19 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 struct dir *
 dir_open (struct inode *inode) 
 {
-  struct dir *dir = calloc (1, sizeof *dir);
+  struct dir *dir = kmem_cache_alloc (dir_cache);
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
       dir->pos = 0;
+      dir->index = NULL;
+      inode_set_metadata (inode);
       return dir;
     }
   else
     {
       inode_close (inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
       return NULL; 
     }
 }
@@ -72,7 +189,8 @@ dir_close (struct dir *dir)
   if (dir != NULL)
     {
       inode_close (dir->inode);
-      free (dir);
+      inode_close (dir->index);
+      kmem_cache_free (dir_cache, dir);
     }
 }
 
@@ -83,32 +201,243 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+/* Reads DIR's header into *H.  Returns true if successful,
+   false if DIR has no valid header. */
+static bool
+read_header (const struct dir *dir, struct dir_header *h)
+{
+  return (inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h
+          && !h->in_use && h->magic == DIR_MAGIC);
+}
+
+/* Writes H as DIR's header.  Returns true if successful. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+write_header (struct dir *dir, const struct dir_header *h)
 {
+  return inode_write_at (dir->inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+/* Makes DIR->index the index that H locates, which another
+   opener of the directory may have replaced since DIR last
+   used it.  Stores the index that DIR used before in *OLD, or a
+   null pointer if it did not change, which the caller must
+   close.  Returns true if successful, false if memory is
+   short. */
+static bool
+open_index (struct dir *dir, const struct dir_header *h,
+            struct inode **old)
+{
+  *old = NULL;
+  if (dir->index != NULL && h->index_sector != 0
+      && inode_get_inumber (dir->index) == h->index_sector)
+    return true;
+
+  *old = dir->index;
+  dir->index = h->index_sector != 0 ? inode_open (h->index_sector) : NULL;
+  if (dir->index != NULL)
+    inode_set_metadata (dir->index);
+  return h->index_sector == 0 || dir->index != NULL;
+}
+
+/* Returns the number of slots in INDEX. */
+static uint32_t
+slot_cnt (struct inode *index)
+{
+  return inode_length (index) / sizeof (struct index_slot) - 1;
+}
+
+/* Reads slot I of INDEX into *S.  Returns true if successful. */
+static bool
+read_slot (struct inode *index, uint32_t i, struct index_slot *s)
+{
+  return (inode_read_at (index, s, sizeof *s, (i + 1) * sizeof *s)
+          == sizeof *s);
+}
+
+/* Writes S as slot I of INDEX.  Returns true if successful. */
+static bool
+write_slot (struct inode *index, uint32_t i, const struct index_slot *s)
+{
+  return (inode_write_at (index, s, sizeof *s, (i + 1) * sizeof *s)
+          == sizeof *s);
+}
+
+/* State of a probe of an index by index_lookup(). */
+struct probe
+  {
+    uint32_t hash;                      /* Hash being looked for. */
+    uint32_t left;                      /* Slots not yet probed. */
+    uint32_t free_slot;                 /* First free slot, or NO_SLOT. */
+    bool done;                          /* Probe is over? */
+    struct index_slot slot;             /* Slot with matching hash. */
+  };
+
+/* inode_scan() function for index_lookup() that probes the
+   index slot S_ at byte offset OFS.  Returns true to stop at a
+   slot whose hash matches, or when the probe is over. */
+static bool
+probe_slot (const void *s_, off_t ofs, void *p_)
+{
+  const struct index_slot *s = s_;
+  struct probe *p = p_;
+
+  p->left--;
+  if (s->ofs == SLOT_EMPTY || s->ofs == SLOT_DELETED)
+    {
+      if (p->free_slot == NO_SLOT)
+        p->free_slot = ofs / sizeof *s - 1;
+      if (s->ofs == SLOT_EMPTY)
+        p->done = true;
+    }
+  else if (s->hash == p->hash)
+    {
+      p->slot = *s;
+      return true;
+    }
+  if (p->left == 0)
+    p->done = true;
+  return p->done;
+}
+
+/* Searches DIR's index for NAME, whose hash is HASH.
+   If successful, returns true, sets *EP to the directory entry,
+   *OFSP to its byte offset, and *SLOTP to the slot that locates
+   it.  Otherwise, returns false and sets *SLOTP to the first
+   slot where NAME could be added, or NO_SLOT if there is none.
+   DIR->index must be up to date.
+
+   Slots are probed in place in the buffer cache with
+   inode_scan(), starting from HASH and wrapping around at the
+   end of the index, and only the entries that they locate are
+   read. */
+static bool
+index_lookup (const struct dir *dir, const char *name, unsigned hash,
+              struct dir_entry *ep, off_t *ofsp, uint32_t *slotp)
+{
+  struct probe p;
+
+  p.hash = hash;
+  p.free_slot = NO_SLOT;
+  p.done = false;
+  if (dir->index != NULL)
+    {
+      uint32_t n = slot_cnt (dir->index);
+      uint32_t i = hash % n;
+
+      p.left = n;
+      while (!p.done)
+        {
+          off_t ofs = inode_scan (dir->index,
+                                  (i + 1) * sizeof (struct index_slot),
+                                  sizeof (struct index_slot),
+                                  probe_slot, &p);
+          if (ofs < 0)
+            {
+              /* Wrap around, unless the index is short. */
+              if (i == 0)
+                break;
+              i = 0;
+              continue;
+            }
+          if (p.done)
+            break;
+
+          i = ofs / sizeof (struct index_slot) - 1;
+          if (inode_read_at (dir->inode, ep, sizeof *ep, p.slot.ofs)
+              == sizeof *ep
+              && ep->in_use && !strcmp (name, ep->name))
+            {
+              *ofsp = p.slot.ofs;
+              *slotp = i;
+              return true;
+            }
+          i = (i + 1) % n;
+        }
+    }
+  *slotp = p.free_slot;
+  return false;
+}
+
+/* Replaces DIR's index, whose header is H, by a new one with
+   room for LIVE_CNT entries and as many again, built from DIR's
+   entries.  Returns true if successful, false if memory or disk
+   space is short. */
+static bool
+rebuild_index (struct dir *dir, struct dir_header *h, uint32_t live_cnt)
+{
+  struct index_header ih = {0, 0};
+  struct inode *index;
+  block_sector_t sector;
   struct dir_entry e;
-  size_t ofs;
-  
-  ASSERT (dir != NULL);
-  ASSERT (name != NULL);
+  uint32_t n;
+  off_t ofs;
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
+  for (n = MIN_SLOTS; n < 2 * (live_cnt + 1); n *= 2)
+    continue;
+  if (!free_map_allocate_near (inode_get_inumber (dir->inode), 1, &sector))
+    return false;
+  if (!inode_create (sector, (n + 1) * sizeof (struct index_slot)))
+    {
+      free_map_release (sector, 1);
+      return false;
+    }
+  index = inode_open (sector);
+  if (index == NULL)
+    return false;
+
+  for (ofs = sizeof e;
+       inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    if (e.in_use)
       {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
+        unsigned hash = hash_string (e.name);
+        struct index_slot s;
+        uint32_t i;
+
+        /* The new index has no deleted slots and no duplicate
+           names, so the first empty slot is the place. */
+        for (i = hash % n; ; i = (i + 1) % n)
+          if (!read_slot (index, i, &s) || s.ofs == SLOT_EMPTY)
+            break;
+        s.hash = hash;
+        s.ofs = ofs;
+        write_slot (index, i, &s);
+        ih.live_cnt = ih.used_cnt = ih.live_cnt + 1;
       }
-  return false;
+  inode_write_at (index, &ih, sizeof ih, 0);
+
+  /* Switch to the new index and delete the old one.  The new
+     index was written without logging it, because it can be
+     large, but the journal puts it on disk before the header
+     that refers to it. */
+  h->index_sector = sector;
+  if (!write_header (dir, h))
+    {
+      inode_remove (index);
+      inode_close (index);
+      return false;
+    }
+  if (dir->index != NULL)
+    inode_remove (dir->index);
+  inode_close (dir->index);
+  dir->index = index;
+  inode_set_metadata (index);
+  return true;
+}
+
+/* inode_scan() function for dir_readdir() that returns true if
+   directory entry E_ is in use, and copies its name to NAME_ if
+   so. */
+static bool
+entry_get_name (const void *e_, off_t ofs UNUSED, void *name_)
+{
+  const struct dir_entry *e = e_;
+  char *name = name_;
+
+  if (!e->in_use)
+    return false;
+  strlcpy (name, e->name, NAME_MAX + 1);
+  return true;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -116,22 +445,100 @@ lookup (const struct dir *dir, const char *name,
    On success, sets *INODE to an inode for the file, otherwise to
    a null pointer.  The caller must close *INODE. */
 bool
-dir_lookup (const struct dir *dir, const char *name,
-            struct inode **inode) 
+dir_lookup (struct dir *dir, const char *name, struct inode **inode) 
 {
+  struct dir_header h;
   struct dir_entry e;
+  struct inode *old_index = NULL;
+  uint32_t slot;
+  off_t ofs;
+  bool found;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
+  rwlock_acquire_read (inode_dir_lock (dir->inode));
+  found = (read_header (dir, &h) && open_index (dir, &h, &old_index)
+           && index_lookup (dir, name, hash_string (name), &e,
+                            &ofs, &slot));
+  if (found)
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  rwlock_release (inode_dir_lock (dir->inode));
+
+  /* Closing an index that another opener replaced may free it.
+     inode_close() takes a transaction for that, after the
+     directory is unlocked; an ordinary lookup takes none. */
+  inode_close (old_index);
 
   return *inode != NULL;
 }
 
+/* Adds a file named NAME to directory DIR, whose header is H.
+   Returns true if successful, false on failure. */
+static bool
+add_indexed (struct dir *dir, struct dir_header *h, const char *name,
+             block_sector_t inode_sector)
+{
+  unsigned hash = hash_string (name);
+  struct index_header ih = {0, 0};
+  struct index_slot s;
+  struct dir_entry e;
+  struct inode *old_index;
+  uint32_t slot;
+  off_t ofs;
+  bool success;
+
+  success = open_index (dir, h, &old_index);
+  inode_close (old_index);
+  if (!success)
+    return false;
+
+  /* Grow the index if it is too full to take another entry. */
+  if (dir->index != NULL
+      && inode_read_at (dir->index, &ih, sizeof ih, 0) != sizeof ih)
+    return false;
+  if ((dir->index == NULL
+       || 4 * (ih.used_cnt + 1) > 3 * slot_cnt (dir->index))
+      && !rebuild_index (dir, h, ih.live_cnt))
+    return false;
+  if (inode_read_at (dir->index, &ih, sizeof ih, 0) != sizeof ih)
+    return false;
+
+  /* Check that NAME is not in use. */
+  if (index_lookup (dir, name, hash, &e, &ofs, &slot) || slot == NO_SLOT
+      || !read_slot (dir->index, slot, &s))
+    return false;
+
+  /* Take a free entry, or add one at the end of the directory. */
+  if (h->free_ofs != 0)
+    {
+      ofs = h->free_ofs;
+      if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+        return false;
+      h->free_ofs = e.inode_sector;
+    }
+  else
+    ofs = inode_length (dir->inode);
+
+  /* Write entry, then index slot, then header. */
+  e.in_use = true;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+    return false;
+
+  if (s.ofs == SLOT_EMPTY)
+    ih.used_cnt++;
+  ih.live_cnt++;
+  s.hash = hash;
+  s.ofs = ofs;
+  return (write_slot (dir->index, slot, &s)
+          && inode_write_at (dir->index, &ih, sizeof ih, 0) == sizeof ih
+          && write_header (dir, h));
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -141,9 +548,8 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
-  bool success = false;
+  struct dir_header h;
+  bool success;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
@@ -152,29 +558,10 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
-
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-
- done:
+  rwlock_acquire_write (inode_dir_lock (dir->inode));
+  success = (read_header (dir, &h)
+             && add_indexed (dir, &h, name, inode_sector));
+  rwlock_release (inode_dir_lock (dir->inode));
   return success;
 }
 
@@ -184,16 +571,23 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_header h;
   struct dir_entry e;
+  struct index_slot s = {0, SLOT_DELETED};
+  struct index_header ih;
   struct inode *inode = NULL;
+  struct inode *old_index = NULL;
   bool success = false;
+  uint32_t slot;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  rwlock_acquire_write (inode_dir_lock (dir->inode));
+  if (!read_header (dir, &h) || !open_index (dir, &h, &old_index)
+      || !index_lookup (dir, name, hash_string (name), &e, &ofs, &slot))
     goto done;
 
   /* Open inode. */
@@ -201,10 +595,22 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Mark the index slot deleted, and put the entry on the free
+     list. */
+  if (inode_read_at (dir->index, &ih, sizeof ih, 0) != sizeof ih
+      || !write_slot (dir->index, slot, &s))
+    goto done;
+  ih.live_cnt--;
+  inode_write_at (dir->index, &ih, sizeof ih, 0);
+  e.inode_sector = h.free_ofs;
+  h.free_ofs = ofs;
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  if (!write_header (dir, &h))
+    goto done;
 
   /* Remove inode. */
   inode_remove (inode);
@@ -212,6 +618,8 @@ dir_remove (struct dir *dir, const char *name)
 
  done:
   inode_close (inode);
+  inode_close (old_index);
+  rwlock_release (inode_dir_lock (dir->inode));
   return success;
 }
 
@@ -221,16 +629,10 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
-
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
-    {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
-    }
-  return false;
+  off_t ofs = inode_scan (dir->inode, dir->pos, sizeof (struct dir_entry),
+                          entry_get_name, name);
+  if (ofs < 0)
+    return false;
+  dir->pos = ofs + sizeof (struct dir_entry);
+  return true;
 }
@@ -1,7 +1,27 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "filesys/cache.h"
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+
+/* Each open file watches for sequential reads, that is, reads
+   that start where the previous one ended.  Each one doubles
+   the file's read-ahead window, from RA_MIN_SECTORS up to
+   RA_MAX_SECTORS, and asks the buffer cache's read-ahead thread
+   to bring in the window's worth of sectors past the end of the
+   read, so that the disk reads them while the reader is busy
+   with what it has.  Any other read closes the window, so that
+   random access does not spend disk time and cache space on
+   sectors that will not be used. */
+
+/* Smallest and largest read-ahead windows, in sectors.  The
+   window is also kept to a quarter of the buffer cache, so that
+   read-ahead does not evict what it has just read. */
+#define RA_MIN_SECTORS 4
+#define RA_MAX_SECTORS 32
+
+/* Read ahead for sequential readers? */
+bool file_readahead = true;
 
 /* An open file. */
 struct file 
@@ -9,26 +29,42 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Start of the next sequential read. */
+    off_t ra_end;               /* End of what has been read ahead. */
+    size_t ra_window;           /* Read-ahead window in sectors, or 0. */
   };
 
+/* Cache of `struct file's. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void) 
+{
+  file_cache = kmem_cache_create ("file", sizeof (struct file), 0, NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (file_cache, file);
       return NULL; 
     }
 }
@@ -49,7 +85,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      kmem_cache_free (file_cache, file);
     }
 }
 
@@ -60,6 +96,46 @@ file_get_inode (struct file *file)
   return file->inode;
 }
 
+/* Reads SIZE bytes from FILE into BUFFER, starting at offset
+   FILE_OFS, for file_read() and file_read_at(), and updates
+   FILE's read-ahead window. */
+static off_t
+read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
+{
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t end = file_ofs + bytes_read;
+  size_t ra_max = cache_size / 4;
+
+  if (ra_max > RA_MAX_SECTORS)
+    ra_max = RA_MAX_SECTORS;
+  if (file_readahead && file_ofs == file->ra_next && bytes_read > 0
+      && ra_max > 0)
+    {
+      off_t ra_start, ra_limit;
+
+      file->ra_window = (file->ra_window == 0 ? RA_MIN_SECTORS
+                         : file->ra_window * 2);
+      if (file->ra_window > ra_max)
+        file->ra_window = ra_max;
+
+      /* Ask only for what was not asked for already. */
+      ra_start = file->ra_end > end ? file->ra_end : end;
+      ra_limit = end + (off_t) file->ra_window * BLOCK_SECTOR_SIZE;
+      if (ra_start < ra_limit)
+        {
+          inode_readahead (file->inode, ra_start, ra_limit - ra_start);
+          file->ra_end = ra_limit;
+        }
+    }
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  file->ra_next = end;
+  return bytes_read;
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
@@ -68,7 +144,7 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read = read_at (file, buffer, size, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,15 +157,14 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  return read_at (file, buffer, size, file_ofs);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file extends the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +177,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -1,10 +1,17 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
 #include "filesys/off_t.h"
 
 struct inode;
 
+/* Read ahead for files that are read sequentially?  On by
+   default.  The load-bench test turns it off to compare. */
+extern bool file_readahead;
+
+void file_init (void);
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
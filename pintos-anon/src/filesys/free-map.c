@@ -1,22 +1,119 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* The free map is kept in memory and written to the free map
+   file, but only the sectors of the file whose bits have
+   changed are written, rather than the whole file.
+
+   Normally the changed sectors are written at the end of every
+   allocation or release, so that the free map file always
+   agrees with the files that use the sectors, as far as the
+   buffer cache's write-behind allows.  If free_map_defer is
+   true, they are written only by free_map_flush(), which
+   filesys_done() calls at shutdown.  That saves the writes
+   entirely for short-lived files, but if the machine stops
+   without shutting down, allocations since the last flush are
+   lost: sectors in use appear free and may be allocated twice.
+   Use it only where a clean shutdown is assured.
+
+   For allocation the disk is divided into groups of GROUP_SECTORS
+   sectors.  Each group remembers how many of its sectors are
+   free, so that full groups can be passed over without looking
+   at their bits, and a cursor below which all of its sectors are
+   in use, so that searches do not scan the same full prefix over
+   and over.  free_map_allocate_near() starts searching at a goal
+   sector, such as a file's inode for the file's data or a
+   directory's inode for a file created in it, so that related
+   sectors end up close together and the disk head moves less.
+
+   Sectors may be reserved ahead of allocation with
+   free_map_reserve(), so that an allocation that must not fail,
+   such as one for data that a write has already accepted, can
+   be made later with free_map_allocate_reserved().  Other
+   allocations leave the reserved number of sectors free.
+
+   Sectors released inside a journal transaction are held by the
+   journal until the transaction commits, because until then the
+   metadata on disk may still refer to them, and the journal then
+   gives them back with free_map_release_held().  Sectors
+   allocated inside a transaction are reported to the journal,
+   which writes them to disk before the metadata that refers to
+   them.
+
+   `free_map_lock' protects the free map, the dirty bits, the
+   allocation groups, and the free and reserved counts.  It is
+   held only while they are examined and changed in memory, never
+   while the free map file is written, so that allocation does
+   not wait for the disk.  A sector of the file is marked clean
+   before it is written, so a change made during the write marks
+   it dirty again and gets written too. */
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty;         /* Changed sectors of the file. */
+static struct lock free_map_lock;    /* Protects the free map. */
+
+/* Number of sectors in an allocation group. */
+#define GROUP_SECTORS 1024
+
+/* Allocation group. */
+struct alloc_group
+  {
+    block_sector_t cursor;      /* All sectors before this are in use. */
+    size_t free_cnt;            /* Number of free sectors. */
+  };
+
+static struct alloc_group *groups;   /* Allocation groups. */
+static size_t group_cnt;             /* Number of allocation groups. */
+static size_t free_cnt;              /* Number of free sectors. */
+static size_t reserved_cnt;          /* Free sectors reserved. */
+
+/* Defer writing the free map until free_map_flush()?
+   Controlled by kernel command-line option "-defer-free-map". */
+bool free_map_defer;
+
+/* Number of free map bits in a sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * CHAR_BIT)
+
+static bool allocate (block_sector_t goal, size_t cnt, bool reserved,
+                      block_sector_t *);
+static void mark_dirty (block_sector_t, size_t cnt);
+static void release (block_sector_t, size_t cnt);
+static bool write_dirty (void);
+static void init_groups (void);
+static void update_groups (block_sector_t, size_t cnt, bool allocated);
+static block_sector_t search (block_sector_t goal, size_t cnt);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
   free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  if (free_map == NULL || !bitmap_add_summary (free_map))
+    PANIC ("bitmap creation failed--file system device is too large");
+  dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                       BLOCK_SECTOR_SIZE));
+  if (dirty == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  groups = malloc (group_cnt * sizeof *groups);
+  if (groups == NULL)
+    PANIC ("allocation group creation failed");
+  lock_init (&free_map_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, JOURNAL_SECTOR);
+  init_groups ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +124,94 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Allocates CNT consecutive sectors from the free map, as soon
+   after GOAL as possible, and stores the first into *SECTORP.
+   Wraps around to the beginning of the disk if there is no room
+   after GOAL.  Returns true if successful, false if not enough
+   consecutive sectors were available or if the free_map file
+   could not be written. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  return allocate (goal, cnt, false, sectorp);
+}
+
+/* Allocates CNT consecutive sectors, like
+   free_map_allocate_near(), out of sectors previously reserved
+   with free_map_reserve(), which they no longer count against.
+   Fails only if the free sectors are too fragmented to hold CNT
+   consecutively, or if the free_map file could not be written,
+   in which case the reservation is kept. */
+bool
+free_map_allocate_reserved (block_sector_t goal, size_t cnt,
+                            block_sector_t *sectorp)
+{
+  return allocate (goal, cnt, true, sectorp);
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Reserves CNT free sectors for later allocation with
+   free_map_allocate_reserved(), so that other allocations
+   cannot use them.  Returns true if successful, false if fewer
+   than CNT free sectors are not already reserved. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors reserved with free_map_reserve() but
+   not allocated. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, or,
+   inside a journal transaction, once it commits. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  if (journal_hold (sector, cnt))
+    return;
+  release (sector, cnt);
+  if (!free_map_defer)
+    write_dirty ();
+}
+
+/* Makes CNT sectors starting at SECTOR, which the journal held
+   for a transaction that has now committed, available for use.
+   The change reaches the free map file the next time it is
+   written, by an allocation or by free_map_flush(), since the
+   journal cannot write files while it commits.  Until then, a
+   crash leaves the sectors marked in use, which wastes them but
+   is safe. */
+void
+free_map_release_held (block_sector_t sector, size_t cnt)
+{
+  release (sector, cnt);
+}
+
+/* Writes any changes to the free map to the free map file. */
+void
+free_map_flush (void)
+{
+  if (!write_dirty ())
+    printf ("free map: write failed, free map may be stale\n");
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,14 +221,17 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_metadata (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  init_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
   file_close (free_map_file);
 }
 
@@ -72,14 +240,207 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  Writing it allocates the file's own
+     sectors, whose bits stay dirty, to be written once the file
+     is in place: writing them from within the write would need
+     the file's inode, which the write already has locked. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  bitmap_set_all (dirty, false);
+  if (!bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  free_map_file = file;
+}
+
+/* Allocates CNT consecutive sectors from the free map, as soon
+   after GOAL as possible, and stores the first into *SECTORP.
+   If RESERVED is true, takes them out of the reserved sectors,
+   otherwise from those not reserved.  Returns true if
+   successful, false if not enough consecutive sectors were
+   available or if the free_map file could not be written. */
+static bool
+allocate (block_sector_t goal, size_t cnt, bool reserved,
+          block_sector_t *sectorp)
+{
+  block_sector_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (!reserved || reserved_cnt >= cnt);
+  if (reserved || free_cnt - reserved_cnt >= cnt)
+    {
+      if (goal >= bitmap_size (free_map))
+        goal = 0;
+      sector = search (goal, cnt);
+      if (sector == BITMAP_ERROR && goal != 0)
+        sector = search (0, cnt);
+    }
+  if (sector != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      update_groups (sector, cnt, true);
+      mark_dirty (sector, cnt);
+      if (reserved)
+        reserved_cnt -= cnt;
+    }
+  lock_release (&free_map_lock);
+
+  if (sector != BITMAP_ERROR && !free_map_defer && !write_dirty ())
+    {
+      lock_acquire (&free_map_lock);
+      bitmap_set_multiple (free_map, sector, cnt, false); 
+      update_groups (sector, cnt, false);
+      if (reserved)
+        reserved_cnt += cnt;
+      lock_release (&free_map_lock);
+      sector = BITMAP_ERROR;
+    }
+  if (sector != BITMAP_ERROR)
+    {
+      journal_allocated (sector, cnt);
+      *sectorp = sector;
+    }
+  return sector != BITMAP_ERROR;
+}
+
+/* Marks the CNT sectors starting at SECTOR free in memory. */
+static void
+release (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  bitmap_set_multiple (free_map, sector, cnt, false);
+  update_groups (sector, cnt, false);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Notes that the bits for the CNT sectors starting at SECTOR
+   have changed.  The caller must hold `free_map_lock'. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  if (cnt > 0)
+    bitmap_set_multiple (dirty, first, last - first + 1, true);
+}
+
+/* Writes the sectors of the free map file whose bits have
+   changed.  Returns true if successful, false if a write failed,
+   in which case the sectors not written stay dirty.  Does
+   nothing before the free map file is open, that is, while the
+   file system is being formatted. */
+static bool
+write_dirty (void)
+{
+  if (free_map_file == NULL)
+    return true;
+
+  for (;;)
+    {
+      size_t idx, start, cnt;
+
+      lock_acquire (&free_map_lock);
+      idx = bitmap_scan_and_flip (dirty, 0, 1, true);
+      lock_release (&free_map_lock);
+      if (idx == BITMAP_ERROR)
+        return true;
+
+      start = idx * BITS_PER_SECTOR;
+      cnt = bitmap_size (free_map) - start;
+      if (cnt > BITS_PER_SECTOR)
+        cnt = BITS_PER_SECTOR;
+      if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+        {
+          lock_acquire (&free_map_lock);
+          bitmap_mark (dirty, idx);
+          lock_release (&free_map_lock);
+          return false;
+        }
+    }
+}
+
+/* Recomputes the allocation groups from the free map. */
+static void
+init_groups (void)
+{
+  size_t i;
+
+  free_cnt = 0;
+  for (i = 0; i < group_cnt; i++)
+    {
+      struct alloc_group *g = &groups[i];
+      block_sector_t start = i * GROUP_SECTORS;
+      size_t size = bitmap_size (free_map) - start;
+
+      if (size > GROUP_SECTORS)
+        size = GROUP_SECTORS;
+      g->cursor = start;
+      g->free_cnt = bitmap_count (free_map, start, size, false);
+      free_cnt += g->free_cnt;
+    }
+}
+
+/* Updates the allocation groups for the CNT sectors starting at
+   SECTOR having been allocated, if ALLOCATED is true, or
+   released, otherwise. */
+static void
+update_groups (block_sector_t sector, size_t cnt, bool allocated)
+{
+  while (cnt > 0)
+    {
+      struct alloc_group *g = &groups[sector / GROUP_SECTORS];
+      size_t n = GROUP_SECTORS - sector % GROUP_SECTORS;
+
+      if (n > cnt)
+        n = cnt;
+      if (allocated)
+        {
+          ASSERT (g->free_cnt >= n);
+          g->free_cnt -= n;
+          free_cnt -= n;
+          if (sector <= g->cursor && g->cursor < sector + n)
+            g->cursor = sector + n;
+        }
+      else
+        {
+          g->free_cnt += n;
+          free_cnt += n;
+          if (sector < g->cursor)
+            g->cursor = sector;
+        }
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Returns the first sector of the first run of CNT free sectors
+   at or after GOAL, or BITMAP_ERROR if there is none.  Starts at
+   the cursor of the first group with free sectors, if that is
+   later than GOAL. */
+static block_sector_t
+search (block_sector_t goal, size_t cnt)
+{
+  size_t i;
+
+  for (i = goal / GROUP_SECTORS; i < group_cnt; i++)
+    {
+      struct alloc_group *g = &groups[i];
+
+      if (g->free_cnt > 0)
+        {
+          if (goal < g->cursor)
+            goal = g->cursor;
+          return bitmap_scan (free_map, goal, cnt, false);
+        }
+    }
+  return BITMAP_ERROR;
 }
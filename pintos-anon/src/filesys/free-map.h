@@ -5,6 +5,10 @@
 #include <stddef.h>
 #include "devices/block.h"
 
+/* Defer writing the free map until free_map_flush()?
+   Controlled by kernel command-line option "-defer-free-map". */
+extern bool free_map_defer;
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
@@ -12,6 +16,14 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t goal, size_t,
+                             block_sector_t *);
+bool free_map_allocate_reserved (block_sector_t goal, size_t,
+                                 block_sector_t *);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
 void free_map_release (block_sector_t, size_t);
+void free_map_release_held (block_sector_t, size_t);
+void free_map_flush (void);
 
 #endif /* filesys/free-map.h */
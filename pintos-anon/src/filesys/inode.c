@@ -1,23 +1,124 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Creates new inodes in the extent format if true, in the block
+   pointer format if false.
+   Controlled by kernel command-line option "-extents". */
+bool inode_extents;
+
+/* Ways that an inode can describe where its data is. */
+enum inode_format
+  {
+    FORMAT_BLOCKS,              /* Direct and indirect block pointers. */
+    FORMAT_EXTENTS,             /* Runs of contiguous sectors. */
+    FORMAT_INLINE               /* Data in the inode itself. */
+  };
+
+/* Number of direct block pointers in an inode. */
+#define DIRECT_CNT 123
+
+/* Number of block pointers in an indirect block. */
+#define PTRS_PER_SECTOR ((off_t) (BLOCK_SECTOR_SIZE / sizeof (block_sector_t)))
+
+/* Largest file size, in sectors, in the block pointer format:
+   the direct blocks, then those reached through the indirect
+   block, then those reached through the doubly indirect block. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/* A run of contiguous sectors. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Number of extents kept in the inode itself. */
+#define INLINE_EXTENTS 30
+
+/* Number of leaf blocks of further extents. */
+#define LEAF_CNT 63
+
+/* Number of extents in a leaf block. */
+#define EXTENTS_PER_LEAF ((off_t) (BLOCK_SECTOR_SIZE / sizeof (struct extent)))
+
+/* Largest number of extents in an inode. */
+#define MAX_EXTENTS (INLINE_EXTENTS + LEAF_CNT * EXTENTS_PER_LEAF)
+
+/* Largest file that fits in the inode itself. */
+#define INLINE_SIZE (BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t))
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file created with at most INLINE_SIZE bytes is kept in the
+   inline format, in which its data follows the inode's header in
+   the inode's own sector, so that it takes no other sectors and
+   reading it takes no disk reads beyond the inode.  When it is
+   written beyond INLINE_SIZE, it is converted to the format of
+   new inodes.
+
+   In the block pointer format, a block pointer of 0 means that
+   no block has been allocated, either because the file is
+   shorter or because that part of it has never been written.
+   Such a hole reads as zeros.  (Sector 0 holds the free map
+   inode, so it is never a data block.)
+
+   In the extent format, the file's first `sector_cnt' sectors
+   are the concatenation of its extents, in order.  The first few
+   extents are in the inode and the rest in leaf blocks that it
+   points to, forming a two-level tree.  An extent whose `start'
+   is 0 is a hole, which has no disk space and reads as zeros.
+   A file created with a nonzero length starts out as a single
+   hole, and a sector is allocated in the middle of the hole when
+   it is first written.  Everything past `sector_cnt' also reads
+   as zeros, which happens only if the machine stopped before
+   delayed data was written. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t format;                    /* An enum inode_format. */
+    union
+      {
+        /* FORMAT_BLOCKS. */
+        struct
+          {
+            block_sector_t direct[DIRECT_CNT]; /* Direct blocks. */
+            block_sector_t indirect;    /* Indirect block. */
+            block_sector_t doubly_indirect; /* Doubly indirect block. */
+          }
+        blocks;
+
+        /* FORMAT_EXTENTS. */
+        struct
+          {
+            uint32_t sector_cnt;        /* Sectors in all extents. */
+            uint32_t extent_cnt;        /* Number of extents. */
+            struct extent extents[INLINE_EXTENTS]; /* First extents. */
+            block_sector_t leaves[LEAF_CNT]; /* Blocks of more extents. */
+          }
+        ext;
+
+        /* FORMAT_INLINE. */
+        uint8_t inline_data[INLINE_SIZE];
+      };
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,51 +129,703 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* Number of sectors of delayed data that an extent inode may
+   hold in memory before allocating disk space for them. */
+#define DELAY_SECTORS 64
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+#define DELAY_PAGES (DELAY_SECTORS / SECTORS_PER_PAGE)
+
+/* In-memory inode.
+
+   `inodes_lock' protects the table of inodes and the list of
+   closed ones, along with each inode's `open_cnt' and `removed'.
+   The rest of an inode is protected by its `rwlock', held for
+   reading to read the file and for writing to write it or to
+   change `data', `delayed', or `deny_write_cnt'.  Thus any
+   number of threads may read a file at once, each perhaps
+   waiting for the disk, and threads using different files never
+   wait for each other here.  Readers share `found', so they
+   update it under `found_lock'.
+
+   A directory's `dir_lock' is held by directory.c around changes
+   to its entries, outside the `rwlock's of the directory and its
+   index.  Locks are acquired in the order journal_begin(),
+   `dir_lock', `rwlock', and then the free map's lock, and
+   `inodes_lock' is never held while waiting for any of them,
+   except at shutdown by inode_flush(). */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in `inodes'. */
+    struct list_elem closed_elem;       /* Element in `closed_inodes'. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool metadata;                      /* Log data in the journal? */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rwlock;               /* Readers share, writers exclude. */
+    struct rwlock dir_lock;             /* Directory only: entries lock. */
     struct inode_disk data;             /* Inode content. */
+
+    /* Extent format only. */
+    struct lock found_lock;             /* Protects the next two. */
+    off_t found_first;                  /* File sector that starts `found'. */
+    struct extent found;                /* Extent last looked up. */
+    uint8_t *delayed[DELAY_PAGES];      /* Pages of delayed data. */
+    size_t delayed_cnt;                 /* Sectors of delayed data. */
+    size_t reserved_cnt;                /* Free map sectors reserved for
+                                           the delayed data. */
   };
 
+/* Allocates a sector, as close after GOAL as possible, zeroes
+   it, and stores its number in *SECTORP.  Returns true if
+   successful, false if the disk is full. */
+static bool
+allocate_zeroed (block_sector_t goal, block_sector_t *sectorp)
+{
+  if (!free_map_allocate_near (goal, 1, sectorp))
+    return false;
+  cache_zero (*sectorp);
+  return true;
+}
+
+/* Returns the block pointer in *SLOT.  If it is 0 and ALLOCATE is
+   true, first allocates a zeroed block near GOAL and stores it
+   there.  Returns 0 if there is no block and none could be
+   allocated. */
+static block_sector_t
+get_slot (block_sector_t *slot, bool allocate, block_sector_t goal)
+{
+  if (*slot == 0 && allocate)
+    allocate_zeroed (goal, slot);
+  return *slot;
+}
+
+/* Returns block pointer IDX within indirect block SECTOR, with
+   the same allocation behavior as get_slot(), except that a new
+   block is placed near SECTOR. */
+static block_sector_t
+get_indirect (block_sector_t sector, off_t idx, bool allocate)
+{
+  block_sector_t ptr;
+  size_t ofs = idx * sizeof ptr;
+
+  cache_read_at (sector, &ptr, ofs, sizeof ptr);
+  if (ptr == 0 && allocate && allocate_zeroed (sector, &ptr))
+    journal_write_at (sector, &ptr, ofs, sizeof ptr);
+  return ptr;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within the file described by DISK, which must be in the block
+   pointer format.  Returns 0 if that part of the file is a hole,
+   unless ALLOCATE is true, in which case a zeroed block is
+   allocated for it, along with any indirect blocks needed to
+   reach it, near GOAL, the sector that holds DISK.  Returns 0
+   if allocation fails or POS is beyond the largest possible
+   file.
+
+   Looking up a block takes at most two reads of indirect
+   blocks, which the buffer cache keeps in memory while the file
+   is in use.  The caller is responsible for writing DISK back if
+   ALLOCATE is true. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode_disk *disk, off_t pos, bool allocate,
+                block_sector_t goal) 
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  off_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t sector;
+
+  ASSERT (disk != NULL);
+  ASSERT (disk->format == FORMAT_BLOCKS);
+  ASSERT (pos >= 0);
+
+  if (idx < DIRECT_CNT)
+    return get_slot (&disk->blocks.direct[idx], allocate, goal);
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      sector = get_slot (&disk->blocks.indirect, allocate, goal);
+      return sector != 0 ? get_indirect (sector, idx, allocate) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      sector = get_slot (&disk->blocks.doubly_indirect, allocate, goal);
+      if (sector != 0)
+        sector = get_indirect (sector, idx / PTRS_PER_SECTOR, allocate);
+      return sector != 0 ? get_indirect (sector, idx % PTRS_PER_SECTOR,
+                                         allocate) : 0;
+    }
+  return 0;
+}
+
+/* Releases SECTOR, which is an indirect block if LEVEL is 1 or a
+   doubly indirect block if LEVEL is 2, along with every block
+   that it points to.  Does nothing if SECTOR is 0. */
+static void
+free_index (block_sector_t sector, int level)
+{
+  if (sector == 0)
+    return;
+  if (level > 0)
+    {
+      off_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        free_index (get_indirect (sector, i, false), level - 1);
+    }
+  free_map_release (sector, 1);
+}
+
+/* Returns extent I of DISK, which must be in the extent
+   format. */
+static struct extent
+get_extent (const struct inode_disk *disk, off_t i)
+{
+  struct extent e;
+
+  ASSERT (i < (off_t) disk->ext.extent_cnt);
+  if (i < INLINE_EXTENTS)
+    return disk->ext.extents[i];
+  i -= INLINE_EXTENTS;
+  cache_read_at (disk->ext.leaves[i / EXTENTS_PER_LEAF], &e,
+                 i % EXTENTS_PER_LEAF * sizeof e, sizeof e);
+  return e;
+}
+
+/* Stores E as extent I of DISK, which must be in the extent
+   format, allocating a leaf block for it if necessary.  Returns
+   true if successful, false if the disk is full. */
+static bool
+set_extent (struct inode_disk *disk, off_t i, struct extent e)
+{
+  block_sector_t *leaf;
+
+  if (i < INLINE_EXTENTS)
+    {
+      disk->ext.extents[i] = e;
+      return true;
+    }
+  i -= INLINE_EXTENTS;
+  leaf = &disk->ext.leaves[i / EXTENTS_PER_LEAF];
+  if (*leaf == 0 && !allocate_zeroed (e.start, leaf))
+    return false;
+  journal_write_at (*leaf, &e, i % EXTENTS_PER_LEAF * sizeof e, sizeof e);
+  return true;
+}
+
+/* Adds CNT sectors starting at START to the end of DISK, which
+   must be in the extent format, extending its last extent if
+   they follow it directly.  Returns true if successful, false if
+   DISK has no room for another extent. */
+static bool
+append_extent (struct inode_disk *disk, block_sector_t start, size_t cnt)
+{
+  uint32_t n = disk->ext.extent_cnt;
+  struct extent e;
+
+  if (n > 0)
+    {
+      e = get_extent (disk, n - 1);
+      if (e.start != 0 && e.start + e.length == start)
+        {
+          e.length += cnt;
+          set_extent (disk, n - 1, e);
+          disk->ext.sector_cnt += cnt;
+          return true;
+        }
+    }
+
+  e.start = start;
+  e.length = cnt;
+  if (n >= MAX_EXTENTS || !set_extent (disk, n, e))
+    return false;
+  disk->ext.extent_cnt++;
+  disk->ext.sector_cnt += cnt;
+  return true;
+}
+
+/* Allocates up to CNT sectors in a single run, out of sectors
+   reserved in the free map, adds them to the end of DISK, which
+   must be in the extent format and is stored in sector
+   INODE_SECTOR, and stores the first of them in *STARTP.  Places
+   them right after DISK's last extent if possible, so that it
+   just grows, or else near the inode.  Asks the free map for
+   fewer sectors, by halves, if it has no run of CNT.  Returns
+   the number of sectors allocated, or 0 if there are none or
+   DISK has no room for another extent. */
+static size_t
+extend_extents (struct inode_disk *disk, block_sector_t inode_sector,
+                size_t cnt, block_sector_t *startp)
+{
+  block_sector_t goal = inode_sector;
+
+  if (disk->ext.extent_cnt > 0)
+    {
+      struct extent last = get_extent (disk, disk->ext.extent_cnt - 1);
+      if (last.start != 0)
+        goal = last.start + last.length;
+    }
+  for (; cnt > 0; cnt /= 2)
+    if (free_map_allocate_reserved (goal, cnt, startp))
+      {
+        if (append_extent (disk, *startp, cnt))
+          return cnt;
+        free_map_release (*startp, cnt);
+        return 0;
+      }
+  return 0;
+}
+
+/* Returns the index of the extent of DISK, which must be in the
+   extent format, that holds file sector IDX, which must be less
+   than its `sector_cnt', and stores the file sector at which the
+   extent begins in *FIRSTP. */
+static uint32_t
+find_extent (const struct inode_disk *disk, off_t idx, off_t *firstp)
+{
+  off_t first = 0;
+  uint32_t i;
+
+  for (i = 0; i < disk->ext.extent_cnt; i++)
+    {
+      struct extent e = get_extent (disk, i);
+      if (idx - first < (off_t) e.length)
+        {
+          *firstp = first;
+          return i;
+        }
+      first += e.length;
+    }
+  NOT_REACHED ();
+}
+
+/* Returns the sector that holds file sector IDX of INODE, which
+   must be in the extent format, or 0 if disk space has not been
+   allocated for it.  Remembers the extent found, so that
+   sequential access seldom has to search. */
+static block_sector_t
+extent_to_sector (struct inode *inode, off_t idx)
+{
+  const struct inode_disk *disk = &inode->data;
+  struct extent found;
+  off_t first;
+
+  if (idx >= (off_t) disk->ext.sector_cnt)
+    return 0;
+
+  lock_acquire (&inode->found_lock);
+  found = inode->found;
+  first = inode->found_first;
+  lock_release (&inode->found_lock);
+
+  if (idx < first || idx - first >= (off_t) found.length)
+    {
+      /* Search without the lock, which may read leaf blocks. */
+      found = get_extent (disk, find_extent (disk, idx, &first));
+      lock_acquire (&inode->found_lock);
+      inode->found = found;
+      inode->found_first = first;
+      lock_release (&inode->found_lock);
+    }
+  if (found.start == 0)
+    return 0;
+  return found.start + (idx - first);
+}
+
+/* Moves extents I and beyond of DISK, which must be in the
+   extent format, DELTA places toward the end, or toward the
+   beginning if DELTA is negative.  Returns true if successful,
+   false if DISK has no room for more extents or a leaf block
+   cannot be allocated, in which case nothing is moved. */
+static bool
+shift_extents (struct inode_disk *disk, uint32_t i, int delta)
+{
+  uint32_t n = disk->ext.extent_cnt;
+  uint32_t j;
+
+  if (n + delta > MAX_EXTENTS)
+    return false;
+  if (delta > 0)
+    {
+      /* Only the first move can need a new leaf block. */
+      for (j = n; j-- > i; )
+        if (!set_extent (disk, j + delta, get_extent (disk, j)))
+          return false;
+    }
+  else
+    for (j = i; j < n; j++)
+      set_extent (disk, j + delta, get_extent (disk, j));
+  disk->ext.extent_cnt = n + delta;
+  return true;
+}
+
+/* Allocates a zeroed sector for file sector IDX of INODE, which
+   must be in the extent format and lie in a hole, splitting the
+   hole around it.  The sector is placed after the previous
+   extent if possible, so that a file written in order grows that
+   extent instead of adding new ones.  Returns the sector, or 0
+   if the disk is full or INODE has no room for more extents.
+   The caller is responsible for writing INODE's `data' back. */
+static block_sector_t
+fill_hole (struct inode *inode, off_t idx)
+{
+  struct inode_disk *disk = &inode->data;
+  struct extent hole, prev;
+  block_sector_t goal = inode->sector;
+  block_sector_t sector;
+  off_t first, ofs;
+  uint32_t i;
+
+  i = find_extent (disk, idx, &first);
+  hole = get_extent (disk, i);
+  ASSERT (hole.start == 0);
+  ofs = idx - first;
+
+  prev.start = 0;
+  if (ofs == 0 && i > 0)
+    {
+      prev = get_extent (disk, i - 1);
+      if (prev.start != 0)
+        goal = prev.start + prev.length;
+    }
+  if (!free_map_allocate_near (goal, 1, &sector))
+    return 0;
+  cache_zero (sector);
+  inode->found.length = 0;
+
+  if (prev.start != 0 && prev.start + prev.length == sector)
+    {
+      /* Grow the previous extent into the hole. */
+      prev.length++;
+      set_extent (disk, i - 1, prev);
+      if (hole.length > 1)
+        {
+          hole.length--;
+          set_extent (disk, i, hole);
+        }
+      else
+        shift_extents (disk, i + 1, -1);
+    }
+  else
+    {
+      /* Replace the hole by the hole before IDX, if any, the new
+         sector, and the hole after IDX, if any. */
+      struct extent pieces[3];
+      int cnt = 0;
+      int j;
+
+      if (ofs > 0)
+        {
+          pieces[cnt].start = 0;
+          pieces[cnt++].length = ofs;
+        }
+      pieces[cnt].start = sector;
+      pieces[cnt++].length = 1;
+      if ((off_t) hole.length > ofs + 1)
+        {
+          pieces[cnt].start = 0;
+          pieces[cnt++].length = hole.length - ofs - 1;
+        }
+      /* Leave room for an extent for each sector of delayed
+         data, which has been promised it. */
+      if (disk->ext.extent_cnt + (cnt - 1) + inode->delayed_cnt > MAX_EXTENTS
+          || !shift_extents (disk, i + 1, cnt - 1))
+        {
+          free_map_release (sector, 1);
+          return 0;
+        }
+      for (j = 0; j < cnt; j++)
+        set_extent (disk, i + j, pieces[j]);
+    }
+  return sector;
+}
+
+/* Writes SIZE bytes from BUFFER to data sector SECTOR of INODE,
+   starting at byte OFS within it, through the journal if INODE
+   holds metadata. */
+static void
+write_data (struct inode *inode, block_sector_t sector, const void *buffer,
+            size_t ofs, size_t size)
+{
+  if (inode->metadata)
+    journal_write_at (sector, buffer, ofs, size);
+  else
+    cache_write_at (sector, buffer, ofs, size);
+}
+
+/* Returns the address of sector I of INODE's delayed data. */
+static uint8_t *
+delayed_sector (struct inode *inode, size_t i)
+{
+  ASSERT (i < DELAY_SECTORS);
+  return (inode->delayed[i / SECTORS_PER_PAGE]
+          + i % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reserves disk space for CNT sectors of INODE's delayed data,
+   in addition to what is already reserved, so that
+   flush_delayed() cannot run out: the sectors themselves, plus
+   leaf blocks for as many new extents.  Returns true if
+   successful, false if the disk is too full or INODE has no room
+   for that many more extents. */
+static bool
+reserve_delayed (struct inode *inode, size_t cnt)
+{
+  size_t need = cnt + DIV_ROUND_UP (cnt, (size_t) EXTENTS_PER_LEAF) + 1;
+
+  if (inode->data.ext.extent_cnt + cnt > MAX_EXTENTS)
+    return false;
+  if (need > inode->reserved_cnt)
+    {
+      if (!free_map_reserve (need - inode->reserved_cnt))
+        return false;
+      inode->reserved_cnt = need;
+    }
+  return true;
+}
+
+/* Allocates the leaf blocks that INODE, which must be in the
+   extent format, needs for its first EXTENT_CNT extents and does
+   not have yet, out of its reserved sectors. */
+static void
+allocate_leaves (struct inode *inode, size_t extent_cnt)
+{
+  block_sector_t *leaves = inode->data.ext.leaves;
+  size_t leaf_cnt = 0;
+  size_t i;
+
+  if (extent_cnt > INLINE_EXTENTS)
+    leaf_cnt = DIV_ROUND_UP (extent_cnt - INLINE_EXTENTS,
+                             (size_t) EXTENTS_PER_LEAF);
+  for (i = 0; i < leaf_cnt && i < LEAF_CNT; i++)
+    if (leaves[i] == 0)
+      {
+        if (inode->reserved_cnt == 0
+            || !free_map_allocate_reserved (inode->sector, 1, &leaves[i]))
+          PANIC ("inode %"PRDSNu": reserved space ran out", inode->sector);
+        inode->reserved_cnt--;
+        cache_zero (leaves[i]);
+      }
+}
+
+/* Allocates disk space for INODE's delayed data, in as few runs
+   as the free map allows, and writes the data there.  The space
+   comes out of what reserve_delayed() set aside as the data was
+   added, so this cannot fail for lack of it. */
+static void
+flush_delayed (struct inode *inode)
+{
+  struct inode_disk *disk = &inode->data;
+  size_t done = 0;
+  size_t i;
+
+  if (inode->delayed_cnt == 0)
+    return;
+
+  /* Each run may need a new extent, and each extent a leaf. */
+  allocate_leaves (inode, disk->ext.extent_cnt + inode->delayed_cnt);
+  while (done < inode->delayed_cnt)
+    {
+      block_sector_t start;
+      size_t cnt = extend_extents (disk, inode->sector,
+                                   inode->delayed_cnt - done, &start);
+      if (cnt == 0 || cnt > inode->reserved_cnt)
+        PANIC ("inode %"PRDSNu": reserved space ran out", inode->sector);
+      inode->reserved_cnt -= cnt;
+      for (i = 0; i < cnt; i++)
+        write_data (inode, start + i, delayed_sector (inode, done + i),
+                    0, BLOCK_SECTOR_SIZE);
+      done += cnt;
+    }
+  inode->delayed_cnt = 0;
+  journal_write (inode->sector, disk);
+
+  free_map_unreserve (inode->reserved_cnt);
+  inode->reserved_cnt = 0;
+}
+
+/* Returns the address of the in-memory copy of file sector IDX
+   of INODE, which must be in the extent format and not have disk
+   space for it yet, adding it to the delayed data, zeroed, with
+   disk space reserved for it, if necessary.  If IDX lies beyond
+   the end of the delayed data, writes the delayed data out and
+   leaves the sectors in between as a hole.  Writes out the
+   delayed data first, too, if there is no room for more.
+   Returns a null pointer if memory runs out or disk space cannot
+   be reserved, in which case the write must fail rather than
+   accept data that could not be written later. */
+static uint8_t *
+get_delayed (struct inode *inode, off_t idx)
+{
+  for (;;)
+    {
+      size_t i = idx - inode->data.ext.sector_cnt;
+      size_t n = inode->delayed_cnt;
+
+      ASSERT (idx >= (off_t) inode->data.ext.sector_cnt);
+      if (i < n)
+        return delayed_sector (inode, i);
+
+      if (i > n)
+        {
+          flush_delayed (inode);
+          if (!append_extent (&inode->data, 0,
+                              idx - inode->data.ext.sector_cnt))
+            return NULL;
+          journal_write (inode->sector, &inode->data);
+          continue;
+        }
+      if (n == DELAY_SECTORS)
+        {
+          flush_delayed (inode);
+          continue;
+        }
+      if (!reserve_delayed (inode, n + 1))
+        return NULL;
+      if (inode->delayed[n / SECTORS_PER_PAGE] == NULL)
+        {
+          inode->delayed[n / SECTORS_PER_PAGE] = palloc_get_page (0);
+          if (inode->delayed[n / SECTORS_PER_PAGE] == NULL)
+            return NULL;
+        }
+      memset (delayed_sector (inode, n), 0, BLOCK_SECTOR_SIZE);
+      inode->delayed_cnt++;
+    }
+}
+
+/* Returns the in-memory copy of the sector that contains byte
+   offset POS within INODE, if it is delayed data, otherwise a
+   null pointer. */
+static uint8_t *
+find_delayed (struct inode *inode, off_t pos)
+{
+  size_t i;
+
+  if (inode->data.format != FORMAT_EXTENTS)
+    return NULL;
+  i = pos / BLOCK_SECTOR_SIZE - inode->data.ext.sector_cnt;
+  return i < inode->delayed_cnt ? delayed_sector (inode, i) : NULL;
+}
+
+/* Frees the pages that hold INODE's delayed data, discarding
+   anything in them, and the disk space reserved for it. */
+static void
+free_delayed (struct inode *inode)
+{
+  size_t i;
+
+  for (i = 0; i < DELAY_PAGES; i++)
+    {
+      palloc_free_page (inode->delayed[i]);
+      inode->delayed[i] = NULL;
+    }
+  inode->delayed_cnt = 0;
+  free_map_unreserve (inode->reserved_cnt);
+  inode->reserved_cnt = 0;
+}
+
+/* Releases every data, indirect, and leaf block of DISK. */
+static void
+free_blocks (struct inode_disk *disk)
+{
+  size_t i;
+
+  if (disk->format == FORMAT_INLINE)
+    return;
+  if (disk->format == FORMAT_EXTENTS)
+    {
+      for (i = 0; i < disk->ext.extent_cnt; i++)
+        {
+          struct extent e = get_extent (disk, i);
+          if (e.start != 0)
+            free_map_release (e.start, e.length);
+        }
+      for (i = 0; i < LEAF_CNT; i++)
+        free_index (disk->ext.leaves[i], 0);
+      return;
+    }
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    free_index (disk->blocks.direct[i], 0);
+  free_index (disk->blocks.indirect, 1);
+  free_index (disk->blocks.doubly_indirect, 2);
+}
+
+/* Returns the sector that holds byte offset POS within INODE, or
+   0 if no disk space has been allocated for it. */
+static block_sector_t
+lookup_sector (struct inode *inode, off_t pos)
+{
+  if (inode->data.format == FORMAT_INLINE)
+    return 0;
+  else if (inode->data.format == FORMAT_EXTENTS)
+    return extent_to_sector (inode, pos / BLOCK_SECTOR_SIZE);
   else
-    return -1;
+    return byte_to_sector (&inode->data, pos, false, inode->sector);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, plus some recently closed ones, by sector, so
+   that opening a single inode twice returns the same `struct
+   inode'.
+
+   The table resizes itself all at once, moving every element
+   while `inodes_lock' is held, rather than a few buckets at a
+   time.  That is cheap here: it happens only when the number of
+   entries doubles or halves, the entries are few (the open
+   inodes plus at most CLOSED_MAX closed ones), and moving one
+   touches no disk.  Keeping closed inodes also keeps the count
+   from swinging back and forth across a resize point. */
+static struct hash inodes;
+static struct lock inodes_lock;
+
+/* Closed inodes kept in `inodes', most recently closed first.
+   Reopening one of them does not have to read its sector
+   again, because its `data' is still good: every change to the
+   on-disk inode is made through the `struct inode'. */
+static struct list closed_inodes;
+static size_t closed_cnt;
+
+/* Maximum number of closed inodes kept. */
+#define CLOSED_MAX 64
+
+/* Cache of `struct inode's. */
+static struct kmem_cache *inode_cache;
+
+static struct inode *find_inode (block_sector_t);
+static void reuse_inode (struct inode *);
+static bool drop_opener (struct inode *);
+static void discard_closed (struct inode *);
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&inodes, inode_hash, inode_less, NULL))
+    PANIC ("Not enough memory for the open inode table.");
+  lock_init (&inodes_lock);
+  list_init (&closed_inodes);
+  closed_cnt = 0;
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), 0, NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data is all zeros and, unless it fits in the
+   inode, a hole, so only the inode itself is written: sectors
+   are allocated as they are written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is too
+   large. */
 bool
 inode_create (block_sector_t sector, off_t length)
 {
   struct inode_disk *disk_inode = NULL;
+  struct inode *inode;
   bool success = false;
 
   ASSERT (length >= 0);
@@ -81,25 +834,36 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  /* A closed inode kept for SECTOR would describe a file that
+     has since been freed. */
+  lock_acquire (&inodes_lock);
+  inode = find_inode (sector);
+  if (inode != NULL)
+    {
+      ASSERT (inode->open_cnt == 0);
+      discard_closed (inode);
+    }
+  lock_release (&inodes_lock);
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      if (length <= (off_t) INLINE_SIZE)
+        disk_inode->format = FORMAT_INLINE;
+      else
+        disk_inode->format = inode_extents ? FORMAT_EXTENTS : FORMAT_BLOCKS;
+      if (disk_inode->format == FORMAT_INLINE)
+        success = true;
+      else if (disk_inode->format == FORMAT_EXTENTS)
+        success = sectors == 0 || append_extent (disk_inode, 0, sectors);
+      else
+        success = sectors <= MAX_SECTORS;
+      if (success)
+        journal_write (sector, disk_inode);
       free (disk_inode);
     }
   return success;
@@ -111,42 +875,95 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *other;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
-    }
+  /* Check whether this inode is already open, or was recently. */
+  lock_acquire (&inodes_lock);
+  inode = find_inode (sector);
+  if (inode != NULL)
+    reuse_inode (inode);
+  lock_release (&inodes_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  Reading the sector may wait for the disk, so
+     it is done without holding `inodes_lock'. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->metadata = false;
+  rwlock_init (&inode->rwlock);
+  rwlock_init (&inode->dir_lock);
+  cache_read (inode->sector, &inode->data);
+  lock_init (&inode->found_lock);
+  inode->found_first = 0;
+  inode->found.start = 0;
+  inode->found.length = 0;
+  memset (inode->delayed, 0, sizeof inode->delayed);
+  inode->delayed_cnt = 0;
+  inode->reserved_cnt = 0;
+  if (inode->data.magic != INODE_MAGIC)
+    {
+      /* Not an inode, or one from an unsupported older
+         format. */
+      kmem_cache_free (inode_cache, inode);
+      return NULL;
+    }
+
+  /* Use the inode that another thread opened meanwhile, if
+     any. */
+  lock_acquire (&inodes_lock);
+  other = find_inode (sector);
+  if (other != NULL)
+    reuse_inode (other);
+  else
+    hash_insert (&inodes, &inode->elem);
+  lock_release (&inodes_lock);
+  if (other != NULL)
+    {
+      kmem_cache_free (inode_cache, inode);
+      return other;
+    }
   return inode;
 }
 
+/* Allocates disk space for and writes the delayed data of every
+   open inode.  Holds `inodes_lock' throughout, so it should be
+   called only when the file system is shutting down. */
+void
+inode_flush (void)
+{
+  struct hash_iterator i;
+
+  lock_acquire (&inodes_lock);
+  hash_first (&i, &inodes);
+  while (hash_next (&i)) 
+    {
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+
+      rwlock_acquire_write (&inode->rwlock);
+      flush_delayed (inode);
+      rwlock_release (&inode->rwlock);
+    }
+  lock_release (&inodes_lock);
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inodes_lock);
+      inode->open_cnt++;
+      lock_release (&inodes_lock);
+    }
   return inode;
 }
 
@@ -163,26 +980,74 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool freed = false;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Closing writes to disk only if this is the last opener and
+     the inode was removed or has delayed data.  Otherwise, do
+     without a transaction, so that ordinary closes do not wait
+     for commits. */
+  lock_acquire (&inodes_lock);
+  if (inode->open_cnt > 1
+      || (!inode->removed && inode->delayed_cnt == 0))
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
-        }
+      drop_opener (inode);
+      lock_release (&inodes_lock);
+      return;
+    }
+  lock_release (&inodes_lock);
+
+  journal_begin ();
+  lock_acquire (&inodes_lock);
 
-      free (inode); 
+  /* The last opener writes out delayed data first.  That may
+     wait for the disk, so it does so without `inodes_lock' and
+     then checks again, in case the inode was reopened and
+     written meanwhile.  While it is the only opener, nothing
+     else can change `delayed_cnt'. */
+  while (inode->open_cnt == 1 && !inode->removed && inode->delayed_cnt > 0)
+    {
+      lock_release (&inodes_lock);
+      rwlock_acquire_write (&inode->rwlock);
+      flush_delayed (inode);
+      rwlock_release (&inode->rwlock);
+      lock_acquire (&inodes_lock);
     }
+
+  freed = drop_opener (inode);
+  lock_release (&inodes_lock);
+
+  /* Deallocate blocks of a removed inode.  No other thread can
+     find it any longer. */
+  if (freed)
+    {
+      free_delayed (inode);
+      free_blocks (&inode->data);
+      free_map_release (inode->sector, 1);
+      kmem_cache_free (inode_cache, inode);
+    }
+  journal_end ();
+}
+
+/* Marks INODE as holding file system metadata, such as a
+   directory, whose data is logged in the journal like the inode
+   itself. */
+void
+inode_set_metadata (struct inode *inode)
+{
+  inode->metadata = true;
+}
+
+/* Returns the lock that directory.c holds for reading to look up
+   names in INODE, which must be a directory, and for writing to
+   add or remove them. */
+struct rwlock *
+inode_dir_lock (struct inode *inode)
+{
+  return &inode->dir_lock;
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -191,24 +1056,67 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inodes_lock);
   inode->removed = true;
+  lock_release (&inodes_lock);
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+/* Brings the sector of INODE that holds byte POS, which is
+   SECTOR, into the buffer cache together with the sectors after
+   it, up to byte END, that follow it on disk as well, reading
+   those missing from the cache with one transfer per run.
+   Returns the offset just past the last sector brought in.  The
+   caller must hold INODE's `rwlock'. */
+static off_t
+fill_run (struct inode *inode, block_sector_t sector, off_t pos, off_t end)
+{
+  off_t start = pos - pos % BLOCK_SECTOR_SIZE;
+  size_t max_cnt = cache_run_max ();
+  size_t cnt = 1;
+
+  while (cnt < max_cnt
+         && start + (off_t) cnt * BLOCK_SECTOR_SIZE < end
+         && (lookup_sector (inode, start + (off_t) cnt * BLOCK_SECTOR_SIZE)
+             == sector + cnt))
+    cnt++;
+  if (cnt > 1)
+    cache_read_run (sector, cnt);
+  return start + (off_t) cnt * BLOCK_SECTOR_SIZE;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+   OFFSET, for inode_read_at().  Sectors that are consecutive on
+   disk are read in together.  The caller must hold INODE's
+   `rwlock'. */
+static off_t
+read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t end, run_end;
+
+  if (inode->data.format == FORMAT_INLINE)
+    {
+      bytes_read = inode_length (inode) - offset;
+      if (bytes_read > size)
+        bytes_read = size;
+      if (bytes_read <= 0)
+        return 0;
+      memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+      return bytes_read;
+    }
+
+  /* End of the bytes to read, end of the sectors read in. */
+  end = offset + size < inode_length (inode) ? offset + size
+        : inode_length (inode);
+  run_end = offset;
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = lookup_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      uint8_t *delayed;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -220,91 +1128,275 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx != 0)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          if (offset >= run_end)
+            run_end = fill_run (inode, sector_idx, offset, end);
+          cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                         chunk_size);
         }
+      else if ((delayed = find_delayed (inode, offset)) != NULL)
+        memcpy (buffer + bytes_read, delayed + sector_ofs, chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+  off_t bytes_read;
+
+  rwlock_acquire_read (&inode->rwlock);
+  bytes_read = read_at (inode, buffer, size, offset);
+  rwlock_release (&inode->rwlock);
+  return bytes_read;
+}
+
+/* Asks for the sectors that hold the SIZE bytes of INODE
+   starting at OFFSET to be read into the buffer cache in the
+   background, without waiting for them.  Skips anything past end
+   of file or without disk space. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end, pos;
+
+  rwlock_acquire_read (&inode->rwlock);
+  end = offset + size;
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  if (inode->data.format != FORMAT_INLINE)
+    for (pos = offset - offset % BLOCK_SECTOR_SIZE; pos < end;
+         pos += BLOCK_SECTOR_SIZE)
+      {
+        block_sector_t sector = lookup_sector (inode, pos);
+        if (sector != 0)
+          cache_readahead (sector);
+      }
+  rwlock_release (&inode->rwlock);
+}
+
+/* Largest record that inode_scan() handles. */
+#define SCAN_RECORD_MAX 64
+
+/* Returns the data of the sector of INODE, which must not be in
+   the inline format, that holds byte offset POS, in place: in
+   the buffer cache, in the delayed data, or, for a hole, in a
+   sector of zeros.  If it is in the buffer cache, stores its
+   entry in *EP, which the caller must pass to cache_end_read(),
+   otherwise a null pointer. */
+static const uint8_t *
+sector_in_place (struct inode *inode, off_t pos, struct cache_entry **ep)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t sector = lookup_sector (inode, pos);
+  uint8_t *delayed;
+
+  *ep = NULL;
+  if (sector != 0)
+    return cache_begin_read (sector, ep);
+  delayed = find_delayed (inode, pos);
+  return delayed != NULL ? delayed : zeros;
+}
+
+/* Calls FUNC for each SIZE-byte record of INODE in order,
+   starting at byte OFFSET, passing it the record, its offset,
+   and AUX, until FUNC returns true or the file ends.  Returns
+   the offset of the record for which FUNC returned true, or -1
+   if there is none.
+
+   Unlike inode_read_at(), which copies out what it reads,
+   passes FUNC records in place in the buffer cache, so that a
+   search of many small records, such as directory entries,
+   looks up and locks each sector once instead of once per
+   record.  Only a record that crosses a sector boundary is
+   copied.  FUNC runs with a buffer cache entry locked, so it
+   must not use the file system. */
+off_t
+inode_scan (struct inode *inode, off_t offset, size_t size,
+            inode_scan_func *func, void *aux)
+{
+  uint8_t record[SCAN_RECORD_MAX];
+  off_t found = -1;
+  off_t length;
+
+  ASSERT (size > 0 && size <= SCAN_RECORD_MAX);
+  ASSERT (offset >= 0);
+
+  rwlock_acquire_read (&inode->rwlock);
+  length = inode_length (inode);
+  while (found < 0 && offset + (off_t) size <= length)
+    {
+      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      struct cache_entry *e = NULL;
+      const uint8_t *data;
+      off_t end;
+
+      if (sector_ofs + size > BLOCK_SECTOR_SIZE)
+        {
+          read_at (inode, record, size, offset);
+          if (func (record, offset, aux))
+            found = offset;
+          offset += size;
+          continue;
+        }
+
+      /* Pass every record that lies within this sector. */
+      if (inode->data.format == FORMAT_INLINE)
+        data = inode->data.inline_data;
+      else
+        data = sector_in_place (inode, offset, &e);
+      end = offset - sector_ofs + BLOCK_SECTOR_SIZE;
+      if (end > length)
+        end = length;
+      for (; offset + (off_t) size <= end; offset += size)
+        if (func (data + offset % BLOCK_SECTOR_SIZE, offset, aux))
+          {
+            found = offset;
+            break;
+          }
+      if (e != NULL)
+        cache_end_read (e);
+    }
+  rwlock_release (&inode->rwlock);
+
+  return found;
+}
+
+/* Most bytes that inode_write_at() writes in one journal
+   transaction.  Writing this much changes at most the inode, a
+   few indirect or leaf blocks, and a few sectors of the free
+   map. */
+#define WRITE_CHUNK ((off_t) (32 * BLOCK_SECTOR_SIZE))
+
+static off_t write_at (struct inode *, const void *, off_t size,
+                       off_t offset);
+
+/* Converts INODE from the inline format to the format of new
+   inodes, moving its data out to disk sectors.  Returns true if
+   successful, false if memory or disk space is short, in which
+   case INODE is unchanged. */
+static bool
+uninline (struct inode *inode)
+{
+  off_t length = inode->data.length;
+  uint8_t *data = malloc (INLINE_SIZE);
+  bool success;
+
+  if (data == NULL)
+    return false;
+  memcpy (data, inode->data.inline_data, INLINE_SIZE);
+
+  memset (inode->data.inline_data, 0, INLINE_SIZE);
+  inode->data.format = inode_extents ? FORMAT_EXTENTS : FORMAT_BLOCKS;
+  inode->data.length = 0;
+  success = write_at (inode, data, length, 0) == length;
+  if (!success)
+    {
+      free_delayed (inode);
+      free_blocks (&inode->data);
+      memcpy (inode->data.inline_data, data, INLINE_SIZE);
+      inode->data.format = FORMAT_INLINE;
+      inode->data.length = length;
+      journal_write (inode->sector, &inode->data);
+    }
+  free (data);
+  return success;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   for inode_write_at().  The caller must hold INODE's `rwlock'
+   for writing and be in a journal transaction.
+
+   Writing past end of file extends the file.  Only the sectors
+   actually written get disk space, so any gap between the old
+   end of file and OFFSET is left as a hole.  In the extent
+   format, new data is held in memory and allocated later, in as
+   long a run as possible, by flush_delayed().  In either format,
+   writing into a hole allocates a sector for it.  A file in the inline format
+   is converted to one of the others if it grows too large. */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
+          off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool changed = false;
 
-  if (inode->deny_write_cnt)
-    return 0;
+  ASSERT (rwlock_held_by_current_thread (&inode->rwlock));
+
+  if (inode->data.format == FORMAT_INLINE)
+    {
+      if (offset + size <= (off_t) INLINE_SIZE)
+        {
+          if (size > 0)
+            {
+              memcpy (inode->data.inline_data + offset, buffer, size);
+              if (offset + size > inode->data.length)
+                inode->data.length = offset + size;
+              journal_write (inode->sector, &inode->data);
+            }
+          return size;
+        }
+      if (!uninline (inode))
+        return 0;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = lookup_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx != 0)
+        write_data (inode, sector_idx, buffer + bytes_written, sector_ofs,
+                    chunk_size);
+      else if (inode->data.format == FORMAT_EXTENTS
+               && offset / BLOCK_SECTOR_SIZE
+                  < (off_t) inode->data.ext.sector_cnt)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Allocate a sector in a hole. */
+          sector_idx = fill_hole (inode, offset / BLOCK_SECTOR_SIZE);
+          if (sector_idx == 0)
+            break;
+          changed = true;
+          write_data (inode, sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
         }
-      else 
+      else if (inode->data.format == FORMAT_EXTENTS)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          /* Hold the data in memory until there is enough of it
+             to allocate in one run. */
+          uint8_t *data = get_delayed (inode, offset / BLOCK_SECTOR_SIZE);
+          if (data == NULL)
+            break;
+          memcpy (data + sector_ofs, buffer + bytes_written, chunk_size);
+        }
+      else
+        {
+          /* Allocate a block for a hole or for growth. */
+          sector_idx = byte_to_sector (&inode->data, offset, true,
+                                       inode->sector);
+          if (sector_idx == 0)
+            break;
+          changed = true;
+          write_data (inode, sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
         }
 
       /* Advance. */
@@ -312,7 +1404,57 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  if (bytes_written > 0 && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      changed = true;
+    }
+  if (changed)
+    journal_write (inode->sector, &inode->data);
+
+  /* Metadata must not wait in memory outside the journal. */
+  if (inode->metadata)
+    flush_delayed (inode);
+
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk fills up, the file reaches its
+   largest possible size, or an error occurs.
+
+   Writes WRITE_CHUNK bytes at a time, each in its own journal
+   transaction, unless the caller is already in one, so that the
+   metadata that each part changes fits in the room that a
+   transaction sets aside for an operation.  A crash can thus
+   leave a large write partly done, but never the metadata. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  while (size > 0)
+    {
+      off_t chunk_size = size < WRITE_CHUNK ? size : WRITE_CHUNK;
+      off_t chunk_written = 0;
+
+      journal_begin ();
+      rwlock_acquire_write (&inode->rwlock);
+      if (inode->deny_write_cnt == 0)
+        chunk_written = write_at (inode, buffer + bytes_written, chunk_size,
+                                  offset + bytes_written);
+      rwlock_release (&inode->rwlock);
+      journal_end ();
+
+      bytes_written += chunk_written;
+      size -= chunk_written;
+      if (chunk_written < chunk_size)
+        break;
+    }
 
   return bytes_written;
 }
@@ -322,8 +1464,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +1476,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -343,3 +1489,84 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Returns the open or recently closed inode for SECTOR, or a
+   null pointer if there is none.  The caller must hold
+   `inodes_lock'. */
+static struct inode *
+find_inode (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
+
+/* Takes another reference to INODE, found in `inodes', moving it
+   off the list of closed inodes if it was closed.  The caller
+   must hold `inodes_lock'. */
+static void
+reuse_inode (struct inode *inode)
+{
+  if (inode->open_cnt == 0)
+    {
+      list_remove (&inode->closed_elem);
+      closed_cnt--;
+    }
+  inode->open_cnt++;
+}
+
+/* Drops one opener of INODE, for inode_close().  If it was the
+   last, keeps INODE for a while in case it is reopened, unless
+   it was removed, in which case removes it from `inodes' and
+   returns true: the caller must then free it and its blocks.
+   The caller must hold `inodes_lock'. */
+static bool
+drop_opener (struct inode *inode)
+{
+  if (--inode->open_cnt > 0)
+    return false;
+  if (inode->removed)
+    {
+      hash_delete (&inodes, &inode->elem);
+      return true;
+    }
+  free_delayed (inode);
+  list_push_front (&closed_inodes, &inode->closed_elem);
+  if (++closed_cnt > CLOSED_MAX)
+    discard_closed (list_entry (list_back (&closed_inodes),
+                                struct inode, closed_elem));
+  return false;
+}
+
+/* Forgets closed inode INODE and frees it.  The caller must hold
+   `inodes_lock'. */
+static void
+discard_closed (struct inode *inode)
+{
+  ASSERT (inode->open_cnt == 0);
+
+  list_remove (&inode->closed_elem);
+  closed_cnt--;
+  hash_delete (&inodes, &inode->elem);
+  kmem_cache_free (inode_cache, inode);
+}
+
+/* Returns a hash value for the inode containing hash element E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if the inode containing hash element A is in a
+   lower sector than the one containing B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
@@ -2,20 +2,35 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
 struct bitmap;
+struct rwlock;
+
+/* Create extent-based inodes?
+   Controlled by kernel command-line option "-extents". */
+extern bool inode_extents;
 
 void inode_init (void);
 bool inode_create (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
+void inode_flush (void);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
+void inode_set_metadata (struct inode *);
+struct rwlock *inode_dir_lock (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
+
+/* Called by inode_scan() for each record. */
+typedef bool inode_scan_func (const void *record, off_t ofs, void *aux);
+off_t inode_scan (struct inode *, off_t offset, size_t size,
+                  inode_scan_func *, void *aux);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
@@ -0,0 +1,588 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* Metadata journal.
+
+   Changes to inodes, indirect blocks, directories, and the free
+   map are written with journal_write() or journal_write_at()
+   between journal_begin() and journal_end().  Instead of going
+   to disk as soon as the buffer cache likes, each sector changed
+   this way is held in the cache until the transaction that
+   changed it has been written to the journal, a region of
+   JOURNAL_SECTORS sectors reserved when the file system is
+   formatted.  If the machine stops, journal_init() copies every
+   transaction that made it into the journal to its place on disk
+   at the next boot, so that each operation either happened
+   completely or not at all, whatever the cache had written.
+
+   Every thread that begins a transaction joins the same one,
+   which commits when its last member ends and it is at least
+   half full, or when the "journal" thread finds it waiting every
+   COMMIT_TICKS ticks, so that many operations cost a single
+   journal write.  Each member sets aside room in the transaction
+   for OP_SECTORS sectors when it joins.  If there is not that
+   much room left, the transaction commits first, so that an
+   operation never runs out of room partway through.
+
+   Committing copies the transaction's sectors out of the cache,
+   after which new threads may begin the next transaction while
+   the copies are written.  Before that, the sectors that the
+   transaction allocated, such as new file data, are written to
+   disk, because the committed metadata refers to them; other
+   unlogged sectors reach the disk whenever the cache likes.
+   Sectors that the transaction freed are not released until it
+   has committed, because until then the metadata on disk still
+   refers to them.
+
+   In the journal, a transaction is a descriptor sector, which
+   lists the sectors it changed, followed by their contents.
+   The descriptor is written last, so a transaction is valid
+   only if all of it was written.  Transactions are numbered;
+   replay stops at the first descriptor that does not have the
+   next number.  When there might not be room for another
+   transaction, all of the cache is flushed, after which nothing
+   in the journal is needed, and the journal starts over from
+   its beginning.  New threads wait for that, since sectors held
+   for the next transaction could not be flushed.
+
+   A transaction holds at most as many sectors as one descriptor
+   lists, and never more than half the cache, lest the cache run
+   out of sectors that it may evict.  An operation that changes
+   more than OP_SECTORS sectors may use room that no other member
+   has set aside, but past that it writes the rest without
+   logging them, so that a crash in the middle of it can leave it
+   half done.  inode_write_at() splits large writes into several
+   operations so that this does not happen. */
+
+/* Number of sectors in the journal. */
+#define JOURNAL_SECTORS 128
+
+/* Sectors that each operation may log. */
+#define OP_SECTORS 16
+
+/* Ticks between commits of a waiting transaction. */
+#define COMMIT_TICKS (TIMER_FREQ / 5)
+
+/* Identifies a journal header and a descriptor. */
+#define JOURNAL_MAGIC 0x4c4e524a
+#define DESC_MAGIC 0x43534544
+
+/* Journal header, in sector JOURNAL_SECTOR. */
+struct journal_header
+  {
+    unsigned magic;                     /* Always JOURNAL_MAGIC. */
+    block_sector_t start;               /* First sector of journal. */
+    uint32_t size;                      /* Number of sectors in journal. */
+    uint32_t seq;                       /* Number of first transaction. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 16];
+  };
+
+/* Maximum number of sectors in a transaction. */
+#define DESC_SECTORS ((BLOCK_SECTOR_SIZE - 12) / sizeof (block_sector_t))
+
+/* Transaction descriptor, which precedes the transaction's
+   sectors in the journal. */
+struct descriptor
+  {
+    unsigned magic;                     /* Always DESC_MAGIC. */
+    uint32_t seq;                       /* Transaction number. */
+    uint32_t cnt;                       /* Number of sectors. */
+    block_sector_t sectors[DESC_SECTORS]; /* Sectors changed. */
+  };
+
+static bool enabled;                    /* Logging changes? */
+static struct journal_header header;    /* Journal header. */
+static uint32_t head;                   /* Offset of next transaction. */
+static uint32_t next_seq;               /* Number of next transaction. */
+
+/* The running transaction. */
+static block_sector_t txn_sectors[DESC_SECTORS]; /* Sectors changed. */
+static size_t txn_cnt;                  /* Number of sectors changed. */
+static size_t txn_max;                  /* Maximum for `txn_cnt'. */
+static size_t txn_reserved;             /* Room set aside by members. */
+static size_t op_max;                   /* Room each member sets aside. */
+static struct bitmap *txn_allocated;    /* Sectors allocated. */
+static struct bitmap *txn_freed;        /* Sectors freed, still held. */
+static size_t txn_freed_cnt;            /* Number of bits set in it. */
+static int handle_cnt;                  /* Threads in transaction. */
+static bool committing;                 /* Commit in progress? */
+static bool commit_wanted;              /* New threads must wait? */
+static struct lock journal_lock;        /* Protects the above. */
+static struct condition journal_cond;   /* Signaled when a commit ends
+                                           or a member leaves. */
+
+/* The transaction being committed, which only commit() uses.
+   Its bitmaps are swapped with the running transaction's. */
+static struct bitmap *commit_allocated; /* Sectors allocated. */
+static struct bitmap *commit_freed;     /* Sectors freed, still held. */
+static uint8_t *commit_data;            /* Copies of sectors changed. */
+
+/* Sectors copied to or from the journal with one transfer. */
+#define RUN_SECTORS 16
+
+/* Statistics. */
+static long long commit_cnt;            /* Transactions committed. */
+static long long logged_cnt;            /* Sectors logged. */
+static long long unlogged_cnt;          /* Writes too many to log. */
+
+static void replay (void);
+static bool in_transaction (block_sector_t);
+static void request_commit (void);
+static void commit (void);
+static void release_held (struct bitmap *);
+static void checkpoint (void);
+static thread_func commit_thread;
+
+/* Reserves space for a journal on a newly formatted file system
+   and writes its header. */
+void
+journal_create (void)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  const void *buffers[RUN_SECTORS];
+  struct journal_header h;
+  block_sector_t start;
+  size_t i;
+
+  if (!free_map_allocate_near (JOURNAL_SECTOR, JOURNAL_SECTORS, &start))
+    PANIC ("journal creation failed");
+
+  /* Clear out anything that might look like a transaction. */
+  for (i = 0; i < RUN_SECTORS; i++)
+    buffers[i] = zeros;
+  for (i = 0; i < JOURNAL_SECTORS; i += RUN_SECTORS)
+    block_write_multiple (fs_device, start + i,
+                          (JOURNAL_SECTORS - i < RUN_SECTORS
+                           ? JOURNAL_SECTORS - i : RUN_SECTORS), buffers);
+
+  memset (&h, 0, sizeof h);
+  h.magic = JOURNAL_MAGIC;
+  h.start = start;
+  h.size = JOURNAL_SECTORS;
+  h.seq = 1;
+  block_write (fs_device, JOURNAL_SECTOR, &h);
+}
+
+/* Replays the journal, if the file system has one, and starts
+   logging changes to it.  Must be called before anything else
+   reads the file system through the buffer cache. */
+void
+journal_init (void)
+{
+  size_t page_cnt;
+
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct descriptor) <= BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC)
+    return;
+  replay ();
+
+  txn_max = DESC_SECTORS;
+  if (txn_max > cache_size / 2)
+    txn_max = cache_size / 2;
+  if (txn_max == 0 || 1 + txn_max > header.size)
+    return;
+  op_max = OP_SECTORS < txn_max ? OP_SECTORS : txn_max;
+
+  txn_allocated = bitmap_create (block_size (fs_device));
+  txn_freed = bitmap_create (block_size (fs_device));
+  commit_allocated = bitmap_create (block_size (fs_device));
+  commit_freed = bitmap_create (block_size (fs_device));
+  page_cnt = DIV_ROUND_UP (txn_max * BLOCK_SECTOR_SIZE, PGSIZE);
+  commit_data = palloc_get_multiple (0, page_cnt);
+  if (txn_allocated == NULL || txn_freed == NULL
+      || commit_allocated == NULL || commit_freed == NULL
+      || commit_data == NULL)
+    PANIC ("Not enough memory for the journal.");
+  enabled = true;
+  thread_create ("journal", PRI_DEFAULT, commit_thread, NULL);
+}
+
+/* Commits the running transaction and stops logging changes. */
+void
+journal_done (void)
+{
+  if (!enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  request_commit ();
+  while (committing)
+    cond_wait (&journal_cond, &journal_lock);
+  enabled = false;
+  lock_release (&journal_lock);
+  checkpoint ();
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %lld transactions committed, %lld sectors logged, "
+          "%lld writes not logged\n", commit_cnt, logged_cnt, unlogged_cnt);
+}
+
+/* Joins the running transaction, setting aside room in it for
+   the sectors that the caller will change, and committing it
+   first if there is not enough.  Changes made with
+   journal_write() and journal_write_at() until the matching
+   journal_end() are committed together.  Calls may nest. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0 || !enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      if (commit_wanted)
+        cond_wait (&journal_cond, &journal_lock);
+      else if (txn_cnt + txn_reserved + op_max <= txn_max)
+        break;
+      else
+        request_commit ();
+    }
+  handle_cnt++;
+  txn_reserved += op_max;
+  t->journal_left = op_max;
+  lock_release (&journal_lock);
+}
+
+/* Leaves the running transaction, committing it if it is due
+   and no other thread is still in it. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0 || !enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  ASSERT (handle_cnt > 0);
+  txn_reserved -= t->journal_left;
+  t->journal_left = 0;
+  if (--handle_cnt == 0 && (commit_wanted || txn_cnt >= txn_max / 2))
+    request_commit ();
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Writes BUFFER, which must contain BLOCK_SECTOR_SIZE bytes, to
+   SECTOR as part of the running transaction. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  journal_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR, starting at byte OFS
+   within it, as part of the running transaction.  Outside a
+   transaction, or if the caller has used up its room in the
+   transaction and there is no other room free, the write is not
+   logged. */
+void
+journal_write_at (block_sector_t sector, const void *buffer,
+                  size_t ofs, size_t size)
+{
+  struct thread *t = thread_current ();
+  bool logged = false;
+
+  if (enabled && t->journal_depth > 0)
+    {
+      lock_acquire (&journal_lock);
+      if (in_transaction (sector))
+        logged = true;
+      else if (t->journal_left > 0 || txn_cnt + txn_reserved < txn_max)
+        {
+          if (t->journal_left > 0)
+            {
+              t->journal_left--;
+              txn_reserved--;
+            }
+          txn_sectors[txn_cnt++] = sector;
+          logged = true;
+        }
+      else
+        unlogged_cnt++;
+      lock_release (&journal_lock);
+    }
+
+  if (logged)
+    cache_write_logged_at (sector, buffer, ofs, size);
+  else
+    cache_write_at (sector, buffer, ofs, size);
+}
+
+/* Notes that the CNT sectors starting at SECTOR have been
+   allocated, so that if the caller is in a transaction, they
+   are written to disk before it commits.  The transaction's
+   metadata may refer to them. */
+void
+journal_allocated (block_sector_t sector, size_t cnt)
+{
+  if (!enabled || thread_current ()->journal_depth == 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  bitmap_set_multiple (txn_allocated, sector, cnt, true);
+  lock_release (&journal_lock);
+}
+
+/* If the caller is in a transaction, holds the CNT sectors
+   starting at SECTOR, which it is freeing, until the transaction
+   has committed, then releases them with
+   free_map_release_held(), and returns true.  Otherwise, returns
+   false, and the caller must release them itself. */
+bool
+journal_hold (block_sector_t sector, size_t cnt)
+{
+  if (!enabled || thread_current ()->journal_depth == 0)
+    return false;
+
+  lock_acquire (&journal_lock);
+  bitmap_set_multiple (txn_freed, sector, cnt, true);
+  txn_freed_cnt += cnt;
+  lock_release (&journal_lock);
+  return true;
+}
+
+/* Copies every complete transaction in the journal to its place
+   on disk, then empties the journal. */
+static void
+replay (void)
+{
+  static struct descriptor d;
+  static uint8_t buffer[BLOCK_SECTOR_SIZE];
+  static uint8_t data[RUN_SECTORS][BLOCK_SECTOR_SIZE];
+  void *buffers[RUN_SECTORS];
+  uint32_t ofs = 0;
+  uint32_t seq = header.seq;
+  uint32_t i;
+
+  for (i = 0; i < RUN_SECTORS; i++)
+    buffers[i] = data[i];
+  while (ofs < header.size)
+    {
+      uint32_t cnt;
+
+      block_read (fs_device, header.start + ofs, buffer);
+      memcpy (&d, buffer, sizeof d);
+      if (d.magic != DESC_MAGIC || d.seq != seq || d.cnt > DESC_SECTORS
+          || d.cnt >= header.size - ofs)
+        break;
+
+      for (i = 0; i < d.cnt; i += cnt)
+        {
+          uint32_t j;
+
+          cnt = d.cnt - i < RUN_SECTORS ? d.cnt - i : RUN_SECTORS;
+          block_read_multiple (fs_device, header.start + ofs + 1 + i,
+                               cnt, buffers);
+          for (j = 0; j < cnt; j++)
+            block_write (fs_device, d.sectors[i + j], data[j]);
+        }
+      ofs += 1 + d.cnt;
+      seq++;
+    }
+
+  if (seq != header.seq)
+    printf ("journal: replayed %"PRIu32" transactions\n", seq - header.seq);
+  next_seq = seq;
+  checkpoint ();
+}
+
+/* Returns true if SECTOR has been changed by the running
+   transaction.  The journal lock must be held. */
+static bool
+in_transaction (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < txn_cnt; i++)
+    if (txn_sectors[i] == sector)
+      return true;
+  return false;
+}
+
+/* Commits the running transaction as soon as no thread is in it
+   and no other commit is in progress, keeping new threads out
+   meanwhile.  Returns without committing if another thread does
+   so first.  The journal lock must be held. */
+static void
+request_commit (void)
+{
+  commit_wanted = true;
+  while (commit_wanted && (handle_cnt > 0 || committing))
+    cond_wait (&journal_cond, &journal_lock);
+  if (commit_wanted)
+    commit ();
+}
+
+/* Writes the running transaction to the journal, lets its
+   sectors be written back, and releases the sectors it freed.
+   The journal lock must be held, no thread may be in the
+   transaction, and new threads must be kept out.  The lock is
+   released while writing, and new threads may begin the next
+   transaction once this one has been copied, unless the journal
+   must be checkpointed afterward. */
+static void
+commit (void)
+{
+  static struct descriptor d;
+  static uint8_t buffer[BLOCK_SECTOR_SIZE];
+  const void *buffers[RUN_SECTORS];
+  struct bitmap *swap;
+  size_t cnt = txn_cnt;
+  bool full;
+  size_t run_cnt;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (handle_cnt == 0);
+  ASSERT (commit_wanted && !committing);
+
+  /* Take over the transaction, leaving an empty one running. */
+  committing = true;
+  memset (&d, 0, sizeof d);
+  d.magic = DESC_MAGIC;
+  d.seq = next_seq;
+  d.cnt = cnt;
+  memcpy (d.sectors, txn_sectors, cnt * sizeof *txn_sectors);
+  txn_cnt = 0;
+  swap = txn_allocated;
+  txn_allocated = commit_allocated;
+  commit_allocated = swap;
+  swap = txn_freed;
+  txn_freed = commit_freed;
+  commit_freed = swap;
+  txn_freed_cnt = 0;
+  full = cnt > 0 && head + 1 + cnt + 1 + txn_max > header.size;
+  lock_release (&journal_lock);
+
+  /* Copy the sectors, which nobody can change while new threads
+     are kept out, and let new threads in. */
+  for (i = 0; i < cnt; i++)
+    cache_read (d.sectors[i], commit_data + i * BLOCK_SECTOR_SIZE);
+  if (!full)
+    {
+      lock_acquire (&journal_lock);
+      commit_wanted = false;
+      cond_broadcast (&journal_cond, &journal_lock);
+      lock_release (&journal_lock);
+    }
+
+  /* Data that the metadata refers to goes to disk first. */
+  cache_flush_sectors (commit_allocated);
+  bitmap_set_all (commit_allocated, false);
+
+  if (cnt > 0)
+    {
+      ASSERT (head + 1 + cnt <= header.size);
+      for (i = 0; i < cnt; i += run_cnt)
+        {
+          size_t j;
+
+          run_cnt = cnt - i < RUN_SECTORS ? cnt - i : RUN_SECTORS;
+          for (j = 0; j < run_cnt; j++)
+            buffers[j] = commit_data + (i + j) * BLOCK_SECTOR_SIZE;
+          block_write_multiple (fs_device, header.start + head + 1 + i,
+                                run_cnt, buffers);
+        }
+      memset (buffer, 0, sizeof buffer);
+      memcpy (buffer, &d, sizeof d);
+      block_write (fs_device, header.start + head, buffer);
+      head += 1 + cnt;
+      next_seq++;
+    }
+
+  /* The sectors may go to their places on disk now, except those
+     that the next transaction has changed again. */
+  lock_acquire (&journal_lock);
+  for (i = 0; i < cnt; i++)
+    if (!in_transaction (d.sectors[i]))
+      cache_unlog (d.sectors[i]);
+  lock_release (&journal_lock);
+  release_held (commit_freed);
+  if (full)
+    checkpoint ();
+
+  lock_acquire (&journal_lock);
+  if (full)
+    commit_wanted = false;
+  committing = false;
+  if (cnt > 0)
+    commit_cnt++;
+  logged_cnt += cnt;
+  cond_broadcast (&journal_cond, &journal_lock);
+}
+
+/* Releases the sectors marked in FREED, which the transaction
+   that freed them held until it committed, and clears FREED. */
+static void
+release_held (struct bitmap *freed)
+{
+  size_t size = bitmap_size (freed);
+  size_t start = 0;
+
+  while ((start = bitmap_scan (freed, start, 1, true)) != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (freed, start, 1, false);
+
+      if (end == BITMAP_ERROR)
+        end = size;
+      free_map_release_held (start, end - start);
+      bitmap_set_multiple (freed, start, end - start, false);
+      start = end;
+    }
+}
+
+/* Writes the whole cache to disk, after which the journal's
+   contents are no longer needed, and starts the journal over. */
+static void
+checkpoint (void)
+{
+  cache_flush ();
+  header.seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+  head = 0;
+}
+
+/* Commits the running transaction every COMMIT_TICKS timer
+   ticks, if it has changed or freed anything. */
+static void
+commit_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (COMMIT_TICKS);
+
+      lock_acquire (&journal_lock);
+      if (enabled && (txn_cnt > 0 || txn_freed_cnt > 0))
+        request_commit ();
+      lock_release (&journal_lock);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+void journal_create (void);
+void journal_init (void);
+void journal_done (void);
+void journal_print_stats (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_write (block_sector_t, const void *);
+void journal_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void journal_allocated (block_sector_t, size_t cnt);
+bool journal_hold (block_sector_t, size_t cnt);
+
+#endif /* filesys/journal.h */
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <limits.h>
 #include <round.h>
+#include <stdint.h>
 #include <stdio.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
@@ -21,13 +22,28 @@ typedef unsigned long elem_type;
 /* Number of bits in an element. */
 #define ELEM_BITS (sizeof (elem_type) * CHAR_BIT)
 
+/* Number of elements in a summary group. */
+#define GROUP_ELEMS 64
+
+/* Number of bits in a summary group. */
+#define GROUP_BITS (GROUP_ELEMS * ELEM_BITS)
+
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   A bitmap may also have a summary, which counts the bits set
+   to true in each group of GROUP_ELEMS elements, so that
+   searches can skip groups that are all true or all false
+   without looking at them.  The summary is optional because it
+   must be allocated with malloc(), and because keeping it up to
+   date makes changing bits cost more and not atomic: a bitmap
+   with a summary must be protected by its user's locking. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    uint16_t *summary;  /* Count of true bits per group, or null. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -69,6 +85,44 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the number of bits set to true in ELEM. */
+static inline unsigned
+count_ones (elem_type elem) 
+{
+  unsigned cnt = 0;
+
+  for (; elem != 0; elem &= elem - 1)
+    cnt++;
+  return cnt;
+}
+
+/* Changes element IDX of B to NEW, which must differ from it
+   only in bits that belong to B, and updates B's summary. */
+static inline void
+update_elem (struct bitmap *b, size_t idx, elem_type new)
+{
+  if (b->summary != NULL)
+    b->summary[idx / GROUP_ELEMS] += (count_ones (new)
+                                      - count_ones (b->bits[idx]));
+  b->bits[idx] = new;
+}
+
+/* Returns the number of bits of B in summary group GROUP. */
+static inline size_t
+group_size (const struct bitmap *b, size_t group) 
+{
+  size_t left = b->bit_cnt - group * GROUP_BITS;
+  return left < GROUP_BITS ? left : GROUP_BITS;
+}
+
+/* Returns true if B's summary shows that group GROUP has no bits
+   set to VALUE. */
+static inline bool
+group_lacks (const struct bitmap *b, size_t group, bool value) 
+{
+  return b->summary[group] == (value ? 0 : group_size (b, group));
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -83,6 +137,7 @@ bitmap_create (size_t bit_cnt)
     {
       b->bit_cnt = bit_cnt;
       b->bits = malloc (byte_cnt (bit_cnt));
+      b->summary = NULL;
       if (b->bits != NULL || bit_cnt == 0)
         {
           bitmap_set_all (b, false);
@@ -105,6 +160,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->summary = NULL;
   bitmap_set_all (b, false);
   return b;
 }
@@ -117,6 +173,29 @@ bitmap_buf_size (size_t bit_cnt)
   return sizeof (struct bitmap) + byte_cnt (bit_cnt);
 }
 
+/* Gives B a summary, which makes searching B faster, especially
+   when it is mostly full or mostly empty.  Returns true if
+   successful, false if memory allocation fails.  Calls malloc(),
+   so it may be used on a bitmap created with
+   bitmap_create_in_buf() only after malloc_init(). */
+bool
+bitmap_add_summary (struct bitmap *b) 
+{
+  size_t group_cnt = DIV_ROUND_UP (b->bit_cnt, GROUP_BITS);
+  size_t i;
+
+  ASSERT (b != NULL);
+
+  if (b->summary != NULL)
+    return true;
+  b->summary = malloc (group_cnt * sizeof *b->summary);
+  if (b->summary == NULL && group_cnt > 0)
+    return false;
+  for (i = 0; i < group_cnt; i++)
+    b->summary[i] = bitmap_count (b, i * GROUP_BITS, group_size (b, i), true);
+  return true;
+}
+
 /* Destroys bitmap B, freeing its storage.
    Not for use on bitmaps created by bitmap_create_in_buf(). */
 void
@@ -124,6 +203,7 @@ bitmap_destroy (struct bitmap *b)
 {
   if (b != NULL) 
     {
+      free (b->summary);
       free (b->bits);
       free (b);
     }
@@ -159,6 +239,12 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
+  if (b->summary != NULL)
+    {
+      update_elem (b, idx, b->bits[idx] | mask);
+      return;
+    }
+
   /* This is equivalent to `b->bits[idx] |= mask' except that it
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
@@ -172,6 +258,12 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
+  if (b->summary != NULL)
+    {
+      update_elem (b, idx, b->bits[idx] & ~mask);
+      return;
+    }
+
   /* This is equivalent to `b->bits[idx] &= ~mask' except that it
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
@@ -187,6 +279,12 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
+  if (b->summary != NULL)
+    {
+      update_elem (b, idx, b->bits[idx] ^ mask);
+      return;
+    }
+
   /* This is equivalent to `b->bits[idx] ^= mask' except that it
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
@@ -213,18 +311,47 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Returns a mask of the bits of element IDX that are in the
+   range of bits from START to END, exclusive. */
+static inline elem_type
+range_mask (size_t idx, size_t start, size_t end) 
+{
+  size_t first = idx * ELEM_BITS;
+  elem_type mask = (elem_type) -1;
+
+  if (start > first)
+    mask &= (elem_type) -1 << (start - first);
+  if (end < first + ELEM_BITS)
+    mask &= ((elem_type) 1 << (end - first)) - 1;
+  return mask;
+}
+
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element of B is updated atomically. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt;
+  size_t idx;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    {
+      elem_type mask = range_mask (idx, start, end);
+
+      if (b->summary != NULL)
+        update_elem (b, idx, (value ? b->bits[idx] | mask
+                              : b->bits[idx] & ~mask));
+      else if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,17 +359,56 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t idx, ones;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  if (cnt == 0)
+    return 0;
+  ones = 0;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    ones += count_ones (b->bits[idx] & range_mask (idx, start, end));
+  return value ? ones : cnt - ones;
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Examines a whole element at a time, and skips whole groups
+   if B has a summary. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value) 
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  elem_type bits;
+  size_t idx;
+
+  if (start >= end)
+    return end;
+
+  idx = elem_idx (start);
+  bits = (b->bits[idx] ^ flip) & ((elem_type) -1 << (start % ELEM_BITS));
+  for (;;) 
+    {
+      if (bits != 0)
+        {
+          size_t bit_idx = idx * ELEM_BITS + __builtin_ctzl (bits);
+          return bit_idx < end ? bit_idx : end;
+        }
+
+      if (++idx * ELEM_BITS >= end)
+        return end;
+      if (b->summary != NULL && idx % GROUP_ELEMS == 0)
+        while (group_lacks (b, idx / GROUP_ELEMS, value))
+          {
+            idx += GROUP_ELEMS;
+            if (idx * ELEM_BITS >= end)
+              return end;
+          }
+      bits = b->bits[idx] ^ flip;
+    }
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,16 +416,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -298,13 +459,28 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      /* Find a bit set to VALUE, then see whether the CNT - 1
+         bits that follow it are too.  If not, the run cannot
+         start before the first bit that is not. */
+      while (i <= last)
+        {
+          size_t end;
+
+          i = find_next (b, i, last + 1, value);
+          if (i > last)
+            break;
+          end = find_next (b, i, i + cnt, !value);
+          if (end == i + cnt)
+            return i;
+          i = end + 1;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -346,6 +522,12 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      if (b->summary != NULL)
+        {
+          free (b->summary);
+          b->summary = NULL;
+          success = bitmap_add_summary (b) && success;
+        }
     }
   return success;
 }
@@ -358,6 +540,28 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at
+   START, rounded out to whole elements, to the same place in
+   FILE that bitmap_write() would.  Returns true if successful,
+   false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t ofs, size;
+
+  ASSERT (start + cnt <= b->bit_cnt);
+  if (cnt == 0)
+    return true;
+
+  first = elem_idx (start);
+  last = elem_idx (start + cnt - 1);
+  ofs = first * sizeof (elem_type);
+  size = (last - first + 1) * sizeof (elem_type);
+  return file_write_at (file, b->bits + first, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
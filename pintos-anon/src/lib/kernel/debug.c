@@ -36,6 +36,8 @@ debug_panic (const char *file, int line, const char *function,
       va_end (args);
 
       debug_backtrace ();
+      if (thread_sched_trace)
+        thread_print_trace ();
     }
   else if (level == 2)
     printf ("Kernel PANIC recursion at %s:%d in %s().\n",
@@ -0,0 +1,180 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* A pairing heap is a tree in which each node is not less than
+   any of its children.  Each node points to its leftmost child,
+   and the children of a node form a doubly linked list of
+   siblings.  The `prev' link of a leftmost child points to its
+   parent instead, and the root's `prev' link is null.
+
+   Two heaps are "melded" in constant time by making the root
+   that is less the leftmost child of the other.  Removing the
+   root leaves a list of subtrees that is melded back into one
+   tree in two passes: first adjacent pairs of subtrees, left to
+   right, then the resulting trees, right to left.  This is what
+   makes the amortized cost of removal logarithmic. */
+
+static struct heap_elem *meld (struct heap *,
+                               struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+
+/* Initializes HEAP as an empty heap ordered by LESS given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *heap, heap_less_func *less, void *aux) 
+{
+  ASSERT (heap != NULL);
+  ASSERT (less != NULL);
+
+  heap->root = NULL;
+  heap->less = less;
+  heap->aux = aux;
+}
+
+/* Returns true if HEAP is empty, false otherwise. */
+bool
+heap_empty (const struct heap *heap) 
+{
+  return heap->root == NULL;
+}
+
+/* Inserts ELEM into HEAP. */
+void
+heap_push (struct heap *heap, struct heap_elem *elem) 
+{
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+
+  elem->child = elem->next = elem->prev = NULL;
+  heap->root = heap->root != NULL ? meld (heap, heap->root, elem) : elem;
+}
+
+/* Returns a maximum element of HEAP, without removing it.
+   Undefined behavior if HEAP is empty. */
+struct heap_elem *
+heap_top (const struct heap *heap) 
+{
+  ASSERT (!heap_empty (heap));
+  return heap->root;
+}
+
+/* Removes and returns a maximum element of HEAP.  Undefined
+   behavior if HEAP is empty. */
+struct heap_elem *
+heap_pop (struct heap *heap) 
+{
+  struct heap_elem *top = heap_top (heap);
+
+  heap->root = merge_pairs (heap, top->child);
+  return top;
+}
+
+/* Removes ELEM, which must be in HEAP, from HEAP. */
+void
+heap_remove (struct heap *heap, struct heap_elem *elem) 
+{
+  struct heap_elem *subtree;
+
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+
+  if (elem == heap->root) 
+    {
+      heap_pop (heap);
+      return;
+    }
+
+  /* Unlink ELEM, with all of its descendants, from its parent
+     or its left sibling. */
+  ASSERT (elem->prev != NULL);
+  if (elem->prev->child == elem)
+    elem->prev->child = elem->next;
+  else
+    elem->prev->next = elem->next;
+  if (elem->next != NULL)
+    elem->next->prev = elem->prev;
+
+  /* Put its descendants back. */
+  subtree = merge_pairs (heap, elem->child);
+  if (subtree != NULL)
+    heap->root = meld (heap, heap->root, subtree);
+}
+
+/* Restores the heap order of HEAP after the key of ELEM, which
+   must be in HEAP, has changed. */
+void
+heap_update (struct heap *heap, struct heap_elem *elem) 
+{
+  heap_remove (heap, elem);
+  heap_push (heap, elem);
+}
+
+/* Melds the trees rooted at A and B, which must not have any
+   siblings or parents, and returns the root of the result. */
+static struct heap_elem *
+meld (struct heap *heap, struct heap_elem *a, struct heap_elem *b) 
+{
+  if (heap->less (a, b, heap->aux)) 
+    {
+      struct heap_elem *tmp = a;
+      a = b;
+      b = tmp;
+    }
+
+  /* Make B the leftmost child of A. */
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  b->prev = a;
+  a->child = b;
+  return a;
+}
+
+/* Melds FIRST and all of its right siblings into a single tree
+   and returns its root, or a null pointer if FIRST is null. */
+static struct heap_elem *
+merge_pairs (struct heap *heap, struct heap_elem *first) 
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root;
+
+  /* First pass: meld adjacent pairs, left to right, stacking up
+     the results through their `next' links. */
+  while (first != NULL) 
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+
+      a->prev = NULL;
+      if (b == NULL) 
+        {
+          first = NULL;
+          a->next = pairs;
+          pairs = a;
+          break;
+        }
+      first = b->next;
+      a->next = b->prev = b->next = NULL;
+
+      a = meld (heap, a, b);
+      a->next = pairs;
+      pairs = a;
+    }
+
+  /* Second pass: meld the stacked trees, right to left. */
+  root = pairs;
+  if (root != NULL) 
+    {
+      pairs = root->next;
+      root->next = NULL;
+      while (pairs != NULL) 
+        {
+          struct heap_elem *tree = pairs;
+          pairs = tree->next;
+          tree->next = NULL;
+          root = meld (heap, root, tree);
+        }
+      root->prev = NULL;
+    }
+  return root;
+}
@@ -0,0 +1,71 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Priority queue.
+
+   This is a pairing heap.  Like the doubly linked lists in
+   list.h, it does not require use of dynamically allocated
+   memory.  Instead, each structure that is a potential heap
+   element must embed a struct heap_elem member.  All of the heap
+   functions operate on these `struct heap_elem's.  The
+   heap_entry macro allows conversion from a struct heap_elem
+   back to a structure object that contains it.
+
+   The heap is ordered by a heap_less_func supplied when it is
+   initialized, and heap_top() returns a maximum element, that
+   is, one that is not less than any other.
+
+   Insertion takes constant time.  Removing the top element, or
+   any other element, takes O(lg n) amortized time.  If the key
+   of an element changes while it is in a heap, call
+   heap_update() to restore the heap order.
+
+   Like list.h, this implementation does no type checking.  An
+   element may be in at most one heap at a time. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem 
+  {
+    struct heap_elem *child;    /* First (leftmost) child. */
+    struct heap_elem *next;     /* Next sibling. */
+    struct heap_elem *prev;     /* Previous sibling, or parent if
+                                   this is a leftmost child. */
+  };
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Heap. */
+struct heap 
+  {
+    struct heap_elem *root;     /* Maximum element, or null. */
+    heap_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) &(HEAP_ELEM)->child    \
+                     - offsetof (STRUCT, MEMBER.child)))
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+bool heap_empty (const struct heap *);
+
+void heap_push (struct heap *, struct heap_elem *);
+struct heap_elem *heap_top (const struct heap *);
+struct heap_elem *heap_pop (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+void heap_update (struct heap *, struct heap_elem *);
+
+#endif /* lib/kernel/heap.h */
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_CYCLE_COUNTS => 1, [<<'EOF']);
+(append-bench-ext) begin
+(append-bench-ext) create "bigfile"
+(append-bench-ext) appending to "bigfile"
+(append-bench-ext) 1 MB: CYCLES cycles per append
+(append-bench-ext) 2 MB: CYCLES cycles per append
+(append-bench-ext) 3 MB: CYCLES cycles per append
+(append-bench-ext) 4 MB: CYCLES cycles per append
+(append-bench-ext) 5 MB: CYCLES cycles per append
+(append-bench-ext) 6 MB: CYCLES cycles per append
+(append-bench-ext) 7 MB: CYCLES cycles per append
+(append-bench-ext) 8 MB: CYCLES cycles per append
+(append-bench-ext) verifying "bigfile"
+(append-bench-ext) remove "bigfile"
+(append-bench-ext) end
+EOF
+pass;
@@ -0,0 +1,100 @@
+/* Grows a file from 0 to 8 MB by appending 4 kB at a time with
+   file_write(), and reports the average cost of an append over
+   each megabyte.  With indexed inodes the cost should stay about
+   flat as the file moves from direct blocks into the indirect
+   and doubly indirect ones.  Then checks the file's size and
+   contents and removes it.
+
+   append-bench-ext runs the same test with extent-based inodes,
+   so that appends are gathered in memory and allocated in long
+   runs. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/filesys/kernel/tests.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+
+/* Size of each append. */
+#define CHUNK_SIZE 4096
+
+/* Final size of the file. */
+#define FILE_SIZE (8 * 1024 * 1024)
+
+/* Appends between reports. */
+#define CHUNKS_PER_MB (1024 * 1024 / CHUNK_SIZE)
+
+static const char file_name[] = "bigfile";
+
+/* Fills BUF with a pattern that depends on chunk number IDX. */
+static void
+fill (char *buf, int idx)
+{
+  size_t i;
+
+  for (i = 0; i < CHUNK_SIZE; i++)
+    buf[i] = idx + i / 7;
+}
+
+void
+test_append_bench (void)
+{
+  char *buf = palloc_get_page (0);
+  char *check_buf = palloc_get_page (0);
+  struct file *file;
+  uint64_t start;
+  int i;
+
+  if (buf == NULL || check_buf == NULL)
+    fail ("out of memory");
+
+  msg ("create \"%s\"", file_name);
+  if (!filesys_create (file_name, 0))
+    fail ("create \"%s\" failed", file_name);
+  file = filesys_open (file_name);
+  if (file == NULL)
+    fail ("open \"%s\" failed", file_name);
+
+  msg ("appending to \"%s\"", file_name);
+  start = timer_cycles ();
+  for (i = 0; i < FILE_SIZE / CHUNK_SIZE; i++)
+    {
+      fill (buf, i);
+      if (file_write (file, buf, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("append %d to \"%s\" failed", i, file_name);
+
+      if ((i + 1) % CHUNKS_PER_MB == 0)
+        {
+          uint64_t now = timer_cycles ();
+          msg ("%d MB: %"PRIu64" cycles per append",
+               (i + 1) / CHUNKS_PER_MB, (now - start) / CHUNKS_PER_MB);
+          start = timer_cycles ();
+        }
+    }
+  if (file_length (file) != FILE_SIZE)
+    fail ("\"%s\" is %"PROTd" bytes long, not %d",
+          file_name, file_length (file), FILE_SIZE);
+
+  msg ("verifying \"%s\"", file_name);
+  file_seek (file, 0);
+  for (i = 0; i < FILE_SIZE / CHUNK_SIZE; i++)
+    {
+      fill (buf, i);
+      if (file_read (file, check_buf, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("read of chunk %d of \"%s\" failed", i, file_name);
+      if (memcmp (check_buf, buf, CHUNK_SIZE))
+        fail ("chunk %d of \"%s\" differs from what was written",
+              i, file_name);
+    }
+  file_close (file);
+
+  msg ("remove \"%s\"", file_name);
+  if (!filesys_remove (file_name))
+    fail ("remove \"%s\" failed", file_name);
+
+  palloc_free_page (check_buf);
+  palloc_free_page (buf);
+}
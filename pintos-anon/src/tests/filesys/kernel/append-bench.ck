@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_CYCLE_COUNTS => 1, [<<'EOF']);
+(append-bench) begin
+(append-bench) create "bigfile"
+(append-bench) appending to "bigfile"
+(append-bench) 1 MB: CYCLES cycles per append
+(append-bench) 2 MB: CYCLES cycles per append
+(append-bench) 3 MB: CYCLES cycles per append
+(append-bench) 4 MB: CYCLES cycles per append
+(append-bench) 5 MB: CYCLES cycles per append
+(append-bench) 6 MB: CYCLES cycles per append
+(append-bench) 7 MB: CYCLES cycles per append
+(append-bench) 8 MB: CYCLES cycles per append
+(append-bench) verifying "bigfile"
+(append-bench) remove "bigfile"
+(append-bench) end
+EOF
+pass;
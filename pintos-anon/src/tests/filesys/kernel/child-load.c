@@ -0,0 +1,12 @@
+/* Executable that the load-bench test reads as the loader
+   would.  Does nothing. */
+
+#include "tests/lib.h"
+
+const char *test_name = "child-load";
+
+int
+main (void) 
+{
+  return 0;
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_CYCLE_COUNTS => 1, [<<'EOF']);
+(create-large-bench-ext) begin
+(create-large-bench-ext) create: CYCLES cycles
+(create-large-bench-ext) checking that "bigfile" reads as zeros
+(create-large-bench-ext) writing middle of "bigfile"
+(create-large-bench-ext) verifying "bigfile"
+(create-large-bench-ext) remove "bigfile"
+(create-large-bench-ext) end
+EOF
+pass;
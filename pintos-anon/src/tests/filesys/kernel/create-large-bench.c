@@ -0,0 +1,105 @@
+/* Creates a 4 MB file, twice the size of the file system, with
+   filesys_create() and reports how long the creation took, which
+   should be about as long as creating an empty file, because no
+   data sectors are allocated or written until they are written.
+   Then checks that the file reads as zeros, writes the middle of
+   it, and removes it.
+
+   create-large-bench-ext runs the same test with extent-based
+   inodes, in which the file starts out as a single extent
+   without disk space. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/filesys/kernel/tests.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+
+/* Size of the file, larger than the file system. */
+#define FILE_SIZE (4 * 1024 * 1024)
+
+/* Size of each read and write. */
+#define CHUNK_SIZE 4096
+
+static const char file_name[] = "bigfile";
+
+/* Fails unless the CHUNK_SIZE bytes of FILE at OFS, read into
+   BUF, are zeros. */
+static void
+check_zeros (struct file *file, char *buf, off_t ofs)
+{
+  size_t i;
+
+  if (file_read_at (file, buf, CHUNK_SIZE, ofs) != CHUNK_SIZE)
+    fail ("read of %d bytes at offset %"PROTd" in \"%s\" failed",
+          CHUNK_SIZE, ofs, file_name);
+  for (i = 0; i < CHUNK_SIZE; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu of chunk at offset %"PROTd" in \"%s\" is not zero",
+            i, ofs, file_name);
+}
+
+void
+test_create_large_bench (void)
+{
+  const off_t middle = FILE_SIZE / 2;
+  char *buf = palloc_get_page (0);
+  struct file *file;
+  uint64_t start, cycles;
+  bool success;
+  size_t i;
+
+  if (buf == NULL)
+    fail ("out of memory");
+
+  start = timer_cycles ();
+  success = filesys_create (file_name, FILE_SIZE);
+  cycles = timer_cycles () - start;
+  if (!success)
+    fail ("create \"%s\" failed", file_name);
+  msg ("create: %"PRIu64" cycles", cycles);
+
+  file = filesys_open (file_name);
+  if (file == NULL)
+    fail ("open \"%s\" failed", file_name);
+  if (file_length (file) != FILE_SIZE)
+    fail ("\"%s\" is %"PROTd" bytes long, not %d",
+          file_name, file_length (file), FILE_SIZE);
+
+  msg ("checking that \"%s\" reads as zeros", file_name);
+  check_zeros (file, buf, 0);
+  check_zeros (file, buf, middle);
+  check_zeros (file, buf, FILE_SIZE - CHUNK_SIZE);
+
+  msg ("writing middle of \"%s\"", file_name);
+  for (i = 0; i < CHUNK_SIZE; i++)
+    buf[i] = i / 7;
+  if (file_write_at (file, buf, CHUNK_SIZE, middle) != CHUNK_SIZE)
+    fail ("write of %d bytes at offset %"PROTd" in \"%s\" failed",
+          CHUNK_SIZE, middle, file_name);
+
+  msg ("verifying \"%s\"", file_name);
+  memset (buf, 0, CHUNK_SIZE);
+  if (file_read_at (file, buf, CHUNK_SIZE, middle) != CHUNK_SIZE)
+    fail ("read of %d bytes at offset %"PROTd" in \"%s\" failed",
+          CHUNK_SIZE, middle, file_name);
+  for (i = 0; i < CHUNK_SIZE; i++)
+    if (buf[i] != (char) (i / 7))
+      fail ("byte %zu of chunk at offset %"PROTd" in \"%s\" differs",
+            i, middle, file_name);
+  check_zeros (file, buf, middle - CHUNK_SIZE);
+  check_zeros (file, buf, middle + CHUNK_SIZE);
+  if (file_length (file) != FILE_SIZE)
+    fail ("\"%s\" is %"PROTd" bytes long, not %d",
+          file_name, file_length (file), FILE_SIZE);
+  file_close (file);
+
+  msg ("remove \"%s\"", file_name);
+  if (!filesys_remove (file_name))
+    fail ("remove \"%s\" failed", file_name);
+
+  palloc_free_page (buf);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_CYCLE_COUNTS => 1, [<<'EOF']);
+(create-large-bench) begin
+(create-large-bench) create: CYCLES cycles
+(create-large-bench) checking that "bigfile" reads as zeros
+(create-large-bench) writing middle of "bigfile"
+(create-large-bench) verifying "bigfile"
+(create-large-bench) remove "bigfile"
+(create-large-bench) end
+EOF
+pass;
@@ -0,0 +1,70 @@
+/* Creates 10,000 files in one directory with filesys_create(),
+   then opens each of them with filesys_open(), then removes each
+   of them with filesys_remove(), and reports the average cycles
+   per operation in each phase.  With a hashed directory index,
+   none of these should get slower as the directory grows.  The
+   checker also reports the file system device's sector reads per
+   operation, from the statistics that the kernel prints at
+   shutdown. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/filesys/kernel/tests.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+
+/* Number of files. */
+#define FILE_CNT 10000
+
+/* Prints the average cycles per operation since START for the
+   phase named PHASE. */
+static void
+report (const char *phase, uint64_t start)
+{
+  uint64_t cycles = timer_cycles () - start;
+
+  msg ("%s: %"PRIu64" cycles per file", phase, cycles / FILE_CNT);
+}
+
+void
+test_dir_hash_bench (void)
+{
+  char name[16];
+  uint64_t start;
+  int i;
+
+  msg ("creating %d files", FILE_CNT);
+  start = timer_cycles ();
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!filesys_create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+  report ("create", start);
+
+  msg ("opening %d files", FILE_CNT);
+  start = timer_cycles ();
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      struct file *file;
+
+      snprintf (name, sizeof name, "file%d", i);
+      file = filesys_open (name);
+      if (file == NULL)
+        fail ("open \"%s\" failed", name);
+      file_close (file);
+    }
+  report ("open", start);
+
+  msg ("removing %d files", FILE_CNT);
+  start = timer_cycles ();
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!filesys_remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+  report ("remove", start);
+}
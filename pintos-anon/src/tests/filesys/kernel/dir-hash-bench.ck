@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_CYCLE_COUNTS => 1, [<<'EOF']);
+(dir-hash-bench) begin
+(dir-hash-bench) creating 10000 files
+(dir-hash-bench) create: CYCLES cycles per file
+(dir-hash-bench) opening 10000 files
+(dir-hash-bench) open: CYCLES cycles per file
+(dir-hash-bench) removing 10000 files
+(dir-hash-bench) remove: CYCLES cycles per file
+(dir-hash-bench) end
+EOF
+
+# Sector reads on the file system device, over all 30,000
+# operations.
+our ($test);
+my ($reads);
+foreach (read_text_file ("$test.output")) {
+    $reads = $1 if /\(filesys\): (\d+) reads, \d+ writes$/;
+}
+fail "missing file system device statistics\n" if !defined $reads;
+pass (sprintf ("%.1f sector reads per operation", $reads / 30000));
@@ -0,0 +1,87 @@
+/* Creates 1,000 files in the root directory, then times
+   dir_lookup() of each of their names, then of as many names
+   that are not there, reporting the average cycles per lookup in
+   each phase, and finally removes the files.  Directory lookups
+   read index slots and entries in place in the buffer cache, so
+   neither phase should allocate memory or copy more than the
+   entry it finds. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/filesys/kernel/tests.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+
+/* Number of files. */
+#define FILE_CNT 1000
+
+/* Number of times to look up each name. */
+#define ROUND_CNT 4
+
+/* Looks up each of FILE_CNT names made from FORMAT in DIR
+   ROUND_CNT times, failing unless each one's presence matches
+   FOUND, and reports the average cycles per lookup for the phase
+   named PHASE. */
+static void
+lookup_all (struct dir *dir, const char *format, bool found,
+            const char *phase)
+{
+  uint64_t cycles = 0;
+  char name[16];
+  int round;
+  int i;
+
+  for (round = 0; round < ROUND_CNT; round++)
+    for (i = 0; i < FILE_CNT; i++)
+      {
+        struct inode *inode;
+        uint64_t start;
+        bool success;
+
+        snprintf (name, sizeof name, format, i);
+        start = timer_cycles ();
+        success = dir_lookup (dir, name, &inode);
+        cycles += timer_cycles () - start;
+        if (success != found)
+          fail ("lookup of \"%s\" %s", name,
+                found ? "failed" : "succeeded");
+        inode_close (inode);
+      }
+  msg ("%s: %"PRIu64" cycles per lookup", phase,
+       cycles / (FILE_CNT * ROUND_CNT));
+}
+
+void
+test_dir_lookup_bench (void)
+{
+  struct dir *dir;
+  char name[16];
+  int i;
+
+  msg ("creating %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!filesys_create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+
+  dir = dir_open_root ();
+  if (dir == NULL)
+    fail ("open root directory failed");
+  msg ("looking up %d files", FILE_CNT);
+  lookup_all (dir, "file%d", true, "hit");
+  msg ("looking up %d missing names", FILE_CNT);
+  lookup_all (dir, "none%d", false, "miss");
+  dir_close (dir);
+
+  msg ("removing %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!filesys_remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+}
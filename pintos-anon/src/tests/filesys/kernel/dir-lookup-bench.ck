@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_CYCLE_COUNTS => 1, [<<'EOF']);
+(dir-lookup-bench) begin
+(dir-lookup-bench) creating 1000 files
+(dir-lookup-bench) looking up 1000 files
+(dir-lookup-bench) hit: CYCLES cycles per lookup
+(dir-lookup-bench) looking up 1000 missing names
+(dir-lookup-bench) miss: CYCLES cycles per lookup
+(dir-lookup-bench) removing 1000 files
+(dir-lookup-bench) end
+EOF
+pass;
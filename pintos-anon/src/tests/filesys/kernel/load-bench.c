@@ -0,0 +1,75 @@
+/* Reads an executable from start to finish, a page at a time,
+   through a newly opened file, the way the loader does when it
+   runs a program, starting each time with nothing in the buffer
+   cache.  Reports the average cycles per load with the open
+   file's read-ahead window and without it. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/filesys/kernel/tests.h"
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Number of loads for each setting. */
+#define LOAD_CNT 20
+
+static const char file_name[] = "child-load";
+
+static uint64_t load (void *page, bool readahead);
+
+void
+test_load_bench (void)
+{
+  void *page = palloc_get_page (0);
+  uint64_t with, without;
+
+  if (page == NULL)
+    fail ("out of memory");
+
+  msg ("loading \"%s\" %d times for each setting", file_name, LOAD_CNT);
+  without = load (page, false);
+  with = load (page, true);
+  msg ("without read-ahead: %"PRIu64" cycles per load", without);
+  msg ("with read-ahead: %"PRIu64" cycles per load", with);
+
+  palloc_free_page (page);
+}
+
+/* Loads the file LOAD_CNT times with FILE_READAHEAD set to
+   READAHEAD, reading it into PAGE, and returns the average
+   cycles per load. */
+static uint64_t
+load (void *page, bool readahead)
+{
+  uint64_t cycles = 0;
+  int i;
+
+  file_readahead = readahead;
+  for (i = 0; i < LOAD_CNT; i++)
+    {
+      struct file *file;
+      uint64_t start;
+      off_t length, ofs, bytes_read;
+
+      cache_discard ();
+      start = timer_cycles ();
+      file = filesys_open (file_name);
+      if (file == NULL)
+        fail ("open \"%s\" failed", file_name);
+      length = file_length (file);
+      for (ofs = 0; (bytes_read = file_read (file, page, PGSIZE)) > 0;
+           ofs += bytes_read)
+        continue;
+      file_close (file);
+      cycles += timer_cycles () - start;
+
+      if (ofs != length)
+        fail ("read %"PROTd" bytes of \"%s\", which has %"PROTd,
+              ofs, file_name, length);
+    }
+  return cycles / LOAD_CNT;
+}
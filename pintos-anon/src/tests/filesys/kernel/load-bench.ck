@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_CYCLE_COUNTS => 1, [<<'EOF']);
+(load-bench) begin
+(load-bench) loading "child-load" 20 times for each setting
+(load-bench) without read-ahead: CYCLES cycles per load
+(load-bench) with read-ahead: CYCLES cycles per load
+(load-bench) end
+EOF
+pass;
@@ -0,0 +1,189 @@
+/* Starts several kernel threads that use the file system at the
+   same time: each one reads a shared file over and over while it
+   creates, writes, reads back, and removes files of its own.
+   Then verifies that the shared file is intact and that the
+   threads' files are gone.
+
+   The threads call the file system's functions directly, so
+   that reads of one file overlap with writes, creations, and
+   removals of others in the inode, directory, free map, and
+   buffer cache code, without depending on user processes. */
+
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/filesys/kernel/tests.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 8
+#define CHUNK_SIZE 512
+#define SHARED_SIZE (16 * CHUNK_SIZE)
+#define PRIVATE_SIZE (8 * CHUNK_SIZE)
+#define ROUND_CNT 4
+
+static const char shared_name[] = "shared";
+
+/* Contents of the shared file. */
+static char *shared;
+
+/* Shared file, opened once for each thread. */
+static struct file *shared_files[THREAD_CNT];
+
+/* Upped by each thread when it finishes. */
+static struct semaphore done;
+
+static thread_func mix_thread;
+static void fill_private (char *, int thread_idx, int round);
+static void compare (const char *actual, const char *expected, size_t size,
+                     const char *name, off_t ofs);
+
+void
+test_syn_mix (void)
+{
+  struct file *file;
+  char *check;
+  int i;
+
+  shared = malloc (SHARED_SIZE);
+  check = malloc (SHARED_SIZE);
+  if (shared == NULL || check == NULL)
+    fail ("out of memory");
+
+  random_init (0);
+  random_bytes (shared, SHARED_SIZE);
+  msg ("create \"%s\"", shared_name);
+  if (!filesys_create (shared_name, SHARED_SIZE))
+    fail ("create \"%s\" failed", shared_name);
+  msg ("write \"%s\"", shared_name);
+  file = filesys_open (shared_name);
+  if (file == NULL
+      || file_write_at (file, shared, SHARED_SIZE, 0) != SHARED_SIZE)
+    fail ("write \"%s\" failed", shared_name);
+  file_close (file);
+
+  msg ("start %d threads", THREAD_CNT);
+  sema_init (&done, 0);
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+
+      shared_files[i] = filesys_open (shared_name);
+      if (shared_files[i] == NULL)
+        fail ("open \"%s\" failed", shared_name);
+      snprintf (name, sizeof name, "mix %d", i);
+      thread_create (name, PRI_DEFAULT, mix_thread, (void *) i);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  msg ("all threads finished");
+
+  for (i = 0; i < THREAD_CNT; i++)
+    file_close (shared_files[i]);
+  file = filesys_open (shared_name);
+  if (file == NULL
+      || file_read_at (file, check, SHARED_SIZE, 0) != SHARED_SIZE)
+    fail ("read \"%s\" failed", shared_name);
+  compare (check, shared, SHARED_SIZE, shared_name, 0);
+  file_close (file);
+  msg ("verified contents of \"%s\"", shared_name);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "mix%d", i);
+      file = filesys_open (name);
+      if (file != NULL)
+        fail ("\"%s\" still exists", name);
+    }
+  msg ("threads' files removed");
+
+  free (check);
+  free (shared);
+}
+
+/* Creates, writes, reads back, and removes a file of its own
+   ROUND_CNT times, reading a chunk of the shared file before
+   writing each chunk of its own. */
+static void
+mix_thread (void *idx_)
+{
+  int idx = (int) idx_;
+  struct file *shared_file = shared_files[idx];
+  char *private = malloc (PRIVATE_SIZE);
+  char *block = malloc (PRIVATE_SIZE);
+  char name[16];
+  int round;
+
+  if (private == NULL || block == NULL)
+    fail ("out of memory");
+  snprintf (name, sizeof name, "mix%d", idx);
+
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      struct file *file;
+      off_t ofs;
+
+      fill_private (private, idx, round);
+      if (!filesys_create (name, 0))
+        fail ("create \"%s\" failed", name);
+      file = filesys_open (name);
+      if (file == NULL)
+        fail ("open \"%s\" failed", name);
+      for (ofs = 0; ofs < PRIVATE_SIZE; ofs += CHUNK_SIZE)
+        {
+          off_t shared_ofs = (ofs + round * CHUNK_SIZE) % SHARED_SIZE;
+
+          if (file_read_at (shared_file, block, CHUNK_SIZE, shared_ofs)
+              != CHUNK_SIZE)
+            fail ("read \"%s\" failed", shared_name);
+          compare (block, shared + shared_ofs, CHUNK_SIZE, shared_name,
+                   shared_ofs);
+          if (file_write_at (file, private + ofs, CHUNK_SIZE, ofs)
+              != CHUNK_SIZE)
+            fail ("write \"%s\" failed", name);
+        }
+      if (file_read_at (file, block, PRIVATE_SIZE, 0) != PRIVATE_SIZE)
+        fail ("read \"%s\" failed", name);
+      compare (block, private, PRIVATE_SIZE, name, 0);
+      file_close (file);
+      if (!filesys_remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+
+  free (block);
+  free (private);
+  sema_up (&done);
+}
+
+/* Fills the PRIVATE_SIZE bytes of PRIVATE with data that differs
+   for each THREAD_IDX and ROUND. */
+static void
+fill_private (char *private, int thread_idx, int round)
+{
+  size_t i;
+
+  for (i = 0; i < PRIVATE_SIZE; i++)
+    private[i] = i * 7 + thread_idx * 31 + round * 101;
+}
+
+/* Fails unless the SIZE bytes of ACTUAL, read from NAME at offset
+   OFS, match EXPECTED. */
+static void
+compare (const char *actual, const char *expected, size_t size,
+         const char *name, off_t ofs)
+{
+  size_t i;
+
+  if (!memcmp (actual, expected, size))
+    return;
+  for (i = 0; actual[i] == expected[i]; i++)
+    continue;
+  fail ("%zu bytes read from \"%s\" at offset %"PROTd" differ from those "
+        "written, starting at byte %zu", size, name, ofs, i);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(syn-mix) begin
+(syn-mix) create "shared"
+(syn-mix) write "shared"
+(syn-mix) start 8 threads
+(syn-mix) all threads finished
+(syn-mix) verified contents of "shared"
+(syn-mix) threads' files removed
+(syn-mix) end
+EOF
+pass;
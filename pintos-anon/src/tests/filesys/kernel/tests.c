@@ -0,0 +1,85 @@
+#include "tests/filesys/kernel/tests.h"
+#include <debug.h>
+#include <string.h>
+#include <stdio.h>
+
+/* File system tests that run in the kernel, calling the file
+   system's functions directly from kernel threads. */
+
+struct test 
+  {
+    const char *name;
+    test_func *function;
+  };
+
+static const struct test tests[] = 
+  {
+    {"syn-mix", test_syn_mix},
+    {"load-bench", test_load_bench},
+    {"append-bench", test_append_bench},
+    {"append-bench-ext", test_append_bench},
+    {"dir-hash-bench", test_dir_hash_bench},
+    {"create-large-bench", test_create_large_bench},
+    {"create-large-bench-ext", test_create_large_bench},
+    {"dir-lookup-bench", test_dir_lookup_bench},
+  };
+
+static const char *test_name;
+
+/* Runs the test named NAME. */
+void
+run_test (const char *name) 
+{
+  const struct test *t;
+
+  for (t = tests; t < tests + sizeof tests / sizeof *tests; t++)
+    if (!strcmp (name, t->name))
+      {
+        test_name = name;
+        msg ("begin");
+        t->function ();
+        msg ("end");
+        return;
+      }
+  PANIC ("no test named \"%s\"", name);
+}
+
+/* Prints FORMAT as if with printf(),
+   prefixing the output by the name of the test
+   and following it with a new-line character. */
+void
+msg (const char *format, ...) 
+{
+  va_list args;
+  
+  printf ("(%s) ", test_name);
+  va_start (args, format);
+  vprintf (format, args);
+  va_end (args);
+  putchar ('\n');
+}
+
+/* Prints failure message FORMAT as if with printf(),
+   prefixing the output by the name of the test and FAIL:
+   and following it with a new-line character,
+   and then panics the kernel. */
+void
+fail (const char *format, ...) 
+{
+  va_list args;
+  
+  printf ("(%s) FAIL: ", test_name);
+  va_start (args, format);
+  vprintf (format, args);
+  va_end (args);
+  putchar ('\n');
+
+  PANIC ("test failed");
+}
+
+/* Prints a message indicating the current test passed. */
+void
+pass (void) 
+{
+  printf ("(%s) PASS\n", test_name);
+}
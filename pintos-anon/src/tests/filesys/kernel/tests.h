@@ -0,0 +1,19 @@
+#ifndef TESTS_FILESYS_KERNEL_TESTS_H
+#define TESTS_FILESYS_KERNEL_TESTS_H
+
+void run_test (const char *);
+
+typedef void test_func (void);
+
+extern test_func test_syn_mix;
+extern test_func test_load_bench;
+extern test_func test_append_bench;
+extern test_func test_dir_hash_bench;
+extern test_func test_create_large_bench;
+extern test_func test_dir_lookup_bench;
+
+void msg (const char *, ...);
+void fail (const char *, ...);
+void pass (void);
+
+#endif /* tests/filesys/kernel/tests.h */
@@ -194,3 +194,16 @@ compare_bytes (const void *read_data_, const void *expected_data_, size_t size,
   fail ("%zu bytes read starting at offset %zu in \"%s\" differ "
         "from expected", j - i, ofs + i, file_name);
 }
+
+/* Returns the processor's time-stamp counter, a count of CPU
+   clock cycles, for timing benchmarks.  The counter runs even
+   while the kernel does work on the process's behalf, so the
+   difference between two readings includes system calls. */
+uint64_t
+read_cycles (void) 
+{
+  uint64_t tsc;
+
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
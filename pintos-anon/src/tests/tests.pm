@@ -166,6 +166,11 @@ sub compare_output {
 	delete $options{IGNORE_EXIT_CODES};
 	@output = grep (!/^[a-zA-Z0-9-_]+: exit\(\-?\d+\)$/, @output);
     }
+    my $ignore_cycle_counts = exists $options{IGNORE_CYCLE_COUNTS};
+    if ($ignore_cycle_counts) {
+	delete $options{IGNORE_CYCLE_COUNTS};
+	s/\b\d+ cycles\b/CYCLES cycles/g foreach @output;
+    }
     my $ignore_user_faults = exists $options{IGNORE_USER_FAULTS};
     if ($ignore_user_faults) {
 	delete $options{IGNORE_USER_FAULTS};
@@ -222,6 +227,8 @@ sub compare_output {
     # Failed to match.  Report failure.
     $msg .= "\n(Process exit codes are excluded for matching purposes.)\n"
       if $ignore_exit_codes;
+    $msg .= "\n(Cycle counts are replaced by CYCLES for matching purposes.)\n"
+      if $ignore_cycle_counts;
     $msg .= "\n(User fault messages are excluded for matching purposes.)\n"
       if $ignore_user_faults;
     fail "Test output failed to match any acceptable form.\n\n$msg";
@@ -0,0 +1,118 @@
+/* Creates a large number of threads that sleep for a mix of
+   short and long durations, some long enough to be cascaded
+   down through the levels of the timer wheel.  Verifies that no
+   thread wakes up early and reports the longest time that
+   interrupts were kept off to maintain the sleep queue. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of sleeping threads.  Each one needs a page, so the
+   test is run with more than the default amount of memory. */
+#define THREAD_CNT 1000
+
+/* Number of times each thread sleeps. */
+#define ITERATIONS 3
+
+/* Information about the test. */
+struct sleep_test 
+  {
+    struct semaphore done;      /* Upped once by each thread. */
+    struct lock lock;           /* Protects the fields below. */
+    int early_cnt;              /* Number of early wakeups. */
+    int64_t max_late;           /* Latest wakeup seen, in ticks. */
+  };
+
+/* Information about an individual thread in the test. */
+struct sleep_thread 
+  {
+    struct sleep_test *test;    /* Info shared between all threads. */
+    int id;                     /* Sleeper ID. */
+  };
+
+static void sleeper (void *);
+
+void
+test_alarm_stress (void) 
+{
+  struct sleep_test test;
+  struct sleep_thread *threads;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Creating %d threads to sleep %d times each.",
+       THREAD_CNT, ITERATIONS);
+
+  threads = malloc (sizeof *threads * THREAD_CNT);
+  if (threads == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  sema_init (&test.done, 0);
+  lock_init (&test.lock);
+  test.early_cnt = 0;
+  test.max_late = 0;
+  timer_reset_sleep_stats ();
+
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      struct sleep_thread *t = threads + i;
+      char name[16];
+
+      t->test = &test;
+      t->id = i;
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, t) == TID_ERROR)
+        fail ("could not create thread %d", i);
+    }
+
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&test.done);
+
+  if (test.early_cnt != 0)
+    fail ("%d wakeups were early", test.early_cnt);
+  msg ("All threads woke up on or after their wake time.");
+  msg ("Latest wakeup: %"PRId64" ticks after wake time.", test.max_late);
+  msg ("Max interrupts-off time in sleep queue: %"PRIu64" cycles.",
+       timer_max_sleep_cycles ());
+
+  free (threads);
+}
+
+/* Sleeper thread.  Most sleeps are shorter than one revolution
+   of the root wheel, but every tenth thread also takes one sleep
+   long enough to be cascaded. */
+static void
+sleeper (void *t_) 
+{
+  struct sleep_thread *t = t_;
+  struct sleep_test *test = t->test;
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++) 
+    {
+      int64_t duration = (t->id * 7 + i * 13) % 97 + 1;
+      int64_t wake, late;
+
+      if (t->id % 10 == 0 && i == 0)
+        duration += 300 + t->id % 200;
+      wake = timer_ticks () + duration;
+      timer_sleep (duration);
+      late = timer_ticks () - wake;
+
+      lock_acquire (&test->lock);
+      if (late < 0)
+        test->early_cnt++;
+      else if (late > test->max_late)
+        test->max_late = late;
+      lock_release (&test->lock);
+    }
+  sema_up (&test->done);
+}
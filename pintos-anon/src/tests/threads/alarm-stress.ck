@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "missing begin message\n" if $output[0] ne '(alarm-stress) begin';
+fail "missing end message\n" if $output[$#output] ne '(alarm-stress) end';
+
+local ($_);
+foreach (@output) {
+    fail "$_\n" if /FAIL/;
+}
+fail "some threads did not report waking on time\n"
+  if !grep (/All threads woke up on or after their wake time\./, @output);
+fail "missing interrupts-off measurement\n"
+  if !grep (/Max interrupts-off time in sleep queue: \d+ cycles\./, @output);
+pass;
@@ -0,0 +1,133 @@
+/* Measures bitmap_scan() on a bitmap of 1M bits that is 10%,
+   50%, and 95% full, searching from random starting points for
+   runs of 1, 8, and 64 false bits, first without and then with a
+   summary.  Checks that both give the same results, and some of
+   them against a search that examines one bit at a time. */
+
+#include <bitmap.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "devices/timer.h"
+
+/* Number of bits in the bitmap. */
+#define BIT_CNT (1024 * 1024)
+
+/* Mean length of a run of bits set alike when filling. */
+#define MEAN_RUN 32
+
+/* Number of searches per measurement. */
+#define SEARCH_CNT 200
+
+/* Number of searches per measurement to check against
+   slow_scan(). */
+#define CHECK_CNT 5
+
+static void fill (struct bitmap *, int percent);
+static uint64_t measure (struct bitmap *, size_t cnt, const size_t starts[],
+                         size_t results[]);
+static size_t slow_scan (struct bitmap *, size_t start, size_t cnt);
+
+void
+test_bitmap_bench (void) 
+{
+  static const int percents[] = {10, 50, 95};
+  static const size_t cnts[] = {1, 8, 64};
+  static size_t starts[sizeof cnts / sizeof *cnts][SEARCH_CNT];
+  static size_t results[sizeof cnts / sizeof *cnts][SEARCH_CNT];
+  static size_t summary_results[SEARCH_CNT];
+  size_t p, c, i;
+
+  random_init (0);
+  for (p = 0; p < sizeof percents / sizeof *percents; p++) 
+    {
+      struct bitmap *b = bitmap_create (BIT_CNT);
+      uint64_t plain[sizeof cnts / sizeof *cnts];
+
+      if (b == NULL)
+        fail ("out of memory creating bitmap");
+      fill (b, percents[p]);
+
+      for (c = 0; c < sizeof cnts / sizeof *cnts; c++) 
+        {
+          for (i = 0; i < SEARCH_CNT; i++)
+            starts[c][i] = random_ulong () % BIT_CNT;
+          plain[c] = measure (b, cnts[c], starts[c], results[c]);
+          for (i = 0; i < CHECK_CNT; i++)
+            if (results[c][i] != slow_scan (b, starts[c][i], cnts[c]))
+              fail ("search for %zu bits from %zu found %zu, "
+                    "should be %zu", cnts[c], starts[c][i], results[c][i],
+                    slow_scan (b, starts[c][i], cnts[c]));
+        }
+
+      if (!bitmap_add_summary (b))
+        fail ("out of memory creating summary");
+      for (c = 0; c < sizeof cnts / sizeof *cnts; c++) 
+        {
+          uint64_t summary;
+
+          summary = measure (b, cnts[c], starts[c], summary_results);
+          for (i = 0; i < SEARCH_CNT; i++)
+            if (summary_results[i] != results[c][i])
+              fail ("search for %zu bits from %zu found %zu with summary, "
+                    "%zu without", cnts[c], starts[c][i],
+                    summary_results[i], results[c][i]);
+          msg ("%d%% full, run of %zu: %"PRIu64" cycles without summary, "
+               "%"PRIu64" with.", percents[p], cnts[c], plain[c], summary);
+        }
+      bitmap_destroy (b);
+    }
+}
+
+/* Sets about PERCENT percent of the bits in B to true, in runs
+   of random length. */
+static void
+fill (struct bitmap *b, int percent) 
+{
+  size_t idx = 0;
+
+  while (idx < BIT_CNT) 
+    {
+      size_t len = random_ulong () % (2 * MEAN_RUN) + 1;
+
+      if (len > BIT_CNT - idx)
+        len = BIT_CNT - idx;
+      bitmap_set_multiple (b, idx, len,
+                           random_ulong () % 100 < (unsigned) percent);
+      idx += len;
+    }
+}
+
+/* Searches B for a run of CNT false bits from each of the
+   SEARCH_CNT positions in STARTS[], storing the results in
+   RESULTS[].  Returns the average number of cycles per
+   search. */
+static uint64_t
+measure (struct bitmap *b, size_t cnt, const size_t starts[],
+         size_t results[]) 
+{
+  uint64_t start = timer_cycles ();
+  size_t i;
+
+  for (i = 0; i < SEARCH_CNT; i++)
+    results[i] = bitmap_scan (b, starts[i], cnt, false);
+  return (timer_cycles () - start) / SEARCH_CNT;
+}
+
+/* Returns the first run of CNT false bits in B at or after
+   START, or BITMAP_ERROR, examining one bit at a time. */
+static size_t
+slow_scan (struct bitmap *b, size_t start, size_t cnt) 
+{
+  size_t run = 0;
+  size_t i;
+
+  for (i = start; i < BIT_CNT; i++)
+    if (bitmap_test (b, i))
+      run = 0;
+    else if (++run == cnt)
+      return i + 1 - cnt;
+  return BITMAP_ERROR;
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "missing begin message\n" if $output[0] ne "(bitmap-bench) begin";
+fail "missing end message\n" if $output[$#output] ne "(bitmap-bench) end";
+foreach (@output) {
+    fail "$_\n" if /FAIL/;
+}
+foreach my $percent (10, 50, 95) {
+    foreach my $cnt (1, 8, 64) {
+	fail "missing result for run of $cnt in $percent% full bitmap\n"
+	  if !grep (/^\(bitmap-bench\) $percent% full, run of $cnt: \d+ cycles without summary, \d+ with\.$/,
+		    @output);
+    }
+}
+pass;
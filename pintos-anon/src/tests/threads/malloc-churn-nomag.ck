@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::threads::malloc;
+check_malloc_churn ('malloc-churn-nomag');
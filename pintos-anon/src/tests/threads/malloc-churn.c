@@ -0,0 +1,132 @@
+/* Measures malloc() and free() throughput with several threads
+   allocating and freeing blocks of assorted sizes at once.  Each
+   thread keeps a few blocks allocated, replaces them at random,
+   and checks that no other thread scribbled on them.
+
+   The malloc-churn test uses per-thread magazines and
+   malloc-churn-nomag does not, so that the two can be
+   compared. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of churning threads. */
+#define THREAD_CNT 8
+
+/* Number of malloc() and free() pairs per thread. */
+#define ITER_CNT 20000
+
+/* Number of blocks that a thread keeps allocated. */
+#define SLOT_CNT 16
+
+/* Largest block size, in bytes. */
+#define MAX_SIZE 1024
+
+static void malloc_churn (void);
+static thread_func churn_thread;
+
+void
+test_malloc_churn (void) 
+{
+  ASSERT (malloc_magazines);
+  malloc_churn ();
+}
+
+void
+test_malloc_churn_nomag (void) 
+{
+  ASSERT (!malloc_magazines);
+  malloc_churn ();
+}
+
+static void
+malloc_churn (void) 
+{
+  struct semaphore done;
+  uint64_t start, cycles;
+  int i;
+
+  sema_init (&done, 0);
+  start = timer_cycles ();
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "churn %d", i);
+      if (thread_create (name, PRI_DEFAULT, churn_thread, &done)
+          == TID_ERROR)
+        fail ("could not create thread %d", i);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  cycles = timer_cycles () - start;
+
+  msg ("%d threads did %d malloc/free pairs each.", THREAD_CNT, ITER_CNT);
+  msg ("%"PRIu64" cycles per malloc/free pair.",
+       cycles / (THREAD_CNT * ITER_CNT));
+}
+
+/* Fills BLOCK, of SIZE bytes, with a pattern derived from its
+   address, or checks that the pattern is intact. */
+static void
+pattern (uint8_t *block, size_t size, bool check) 
+{
+  uint8_t value = (uintptr_t) block >> 4;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (!check)
+      block[i] = value + i;
+    else if (block[i] != (uint8_t) (value + i))
+      fail ("block %p corrupted at byte %zu", block, i);
+}
+
+/* Allocates and frees blocks ITER_CNT times. */
+static void
+churn_thread (void *done_) 
+{
+  struct semaphore *done = done_;
+  uint8_t *blocks[SLOT_CNT];
+  size_t sizes[SLOT_CNT];
+  unsigned seed = thread_tid ();
+  int i;
+
+  memset (blocks, 0, sizeof blocks);
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      int slot;
+
+      /* A linear congruential generator, so that threads do not
+         share random number state. */
+      seed = seed * 1103515245 + 12345;
+      slot = (seed >> 16) % SLOT_CNT;
+
+      if (blocks[slot] != NULL) 
+        {
+          pattern (blocks[slot], sizes[slot], true);
+          free (blocks[slot]);
+        }
+
+      /* Favor small blocks, as the kernel does. */
+      sizes[slot] = (seed >> 8) % (MAX_SIZE >> (seed % 6)) + 1;
+      blocks[slot] = malloc (sizes[slot]);
+      if (blocks[slot] == NULL)
+        fail ("malloc of %zu bytes failed", sizes[slot]);
+      pattern (blocks[slot], sizes[slot], false);
+    }
+
+  for (i = 0; i < SLOT_CNT; i++)
+    if (blocks[i] != NULL) 
+      {
+        pattern (blocks[i], sizes[i], true);
+        free (blocks[i]);
+      }
+  sema_up (done);
+}
@@ -0,0 +1,21 @@
+sub check_malloc_churn {
+    my ($name) = @_;
+    our ($test);
+
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+    @output = get_core_output ("run", @output);
+
+    fail "missing begin message\n" if $output[0] ne "($name) begin";
+    fail "missing end message\n" if $output[$#output] ne "($name) end";
+
+    local ($_);
+    foreach (@output) {
+	fail "$_\n" if /FAIL/;
+    }
+    fail "missing throughput\n"
+      if !grep (/^\($name\) \d+ cycles per malloc\/free pair\.$/, @output);
+    pass;
+}
+
+1;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::threads::palloc;
+check_palloc_bench ('palloc-bench-ff');
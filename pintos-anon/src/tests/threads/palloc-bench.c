@@ -0,0 +1,147 @@
+/* Measures the page allocator under a churn of mixed-size
+   requests.  Blocks of 1 to 64 pages are allocated from and
+   freed to the user pool at random.  Every few thousand
+   operations, reports how fragmented the free pages are, as the
+   fraction of them that lies outside the longest run of free
+   pages.  At the end, reports the latency of allocating and
+   freeing and checks that every page came back.
+
+   The palloc-bench test uses the buddy allocator and
+   palloc-bench-ff the first-fit allocator, so that the two can
+   be compared. */
+
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "devices/timer.h"
+
+/* Number of allocations and frees. */
+#define OP_CNT 20000
+
+/* Number of blocks that may be allocated at once. */
+#define SLOT_CNT 32
+
+/* Largest block, in pages. */
+#define MAX_PAGES 64
+
+/* Operations between fragmentation reports. */
+#define REPORT_INTERVAL 5000
+
+/* An allocated block. */
+struct slot 
+  {
+    void *pages;                /* First page, or null if unused. */
+    size_t page_cnt;            /* Number of pages. */
+  };
+
+/* Latency of one kind of operation. */
+struct latency 
+  {
+    uint64_t total;             /* Total cycles. */
+    uint64_t max;               /* Longest operation, in cycles. */
+    int cnt;                    /* Number of operations. */
+  };
+
+static void palloc_bench (void);
+static void report_fragmentation (int op_cnt);
+static void record (struct latency *, uint64_t start);
+
+void
+test_palloc_bench (void) 
+{
+  ASSERT (!palloc_first_fit);
+  palloc_bench ();
+}
+
+void
+test_palloc_bench_ff (void) 
+{
+  ASSERT (palloc_first_fit);
+  palloc_bench ();
+}
+
+static void
+palloc_bench (void) 
+{
+  static struct slot slots[SLOT_CNT];
+  struct latency alloc_lat = {0, 0, 0};
+  struct latency free_lat = {0, 0, 0};
+  size_t start_free, end_free;
+  int failures = 0;
+  int i;
+
+  random_init (0);
+  start_free = palloc_count_free (PAL_USER, NULL);
+
+  for (i = 1; i <= OP_CNT; i++) 
+    {
+      struct slot *s = &slots[random_ulong () % SLOT_CNT];
+      uint64_t start;
+
+      if (s->pages == NULL) 
+        {
+          s->page_cnt = random_ulong () % MAX_PAGES + 1;
+          start = timer_cycles ();
+          s->pages = palloc_get_multiple (PAL_USER, s->page_cnt);
+          record (&alloc_lat, start);
+          if (s->pages == NULL)
+            failures++;
+        }
+      else 
+        {
+          start = timer_cycles ();
+          palloc_free_multiple (s->pages, s->page_cnt);
+          record (&free_lat, start);
+          s->pages = NULL;
+        }
+
+      if (i % REPORT_INTERVAL == 0)
+        report_fragmentation (i);
+    }
+
+  for (i = 0; i < SLOT_CNT; i++)
+    if (slots[i].pages != NULL) 
+      {
+        palloc_free_multiple (slots[i].pages, slots[i].page_cnt);
+        slots[i].pages = NULL;
+      }
+
+  msg ("%d failed allocations.", failures);
+  msg ("Allocate: %"PRIu64" cycles average, %"PRIu64" cycles max.",
+       alloc_lat.total / alloc_lat.cnt, alloc_lat.max);
+  msg ("Free: %"PRIu64" cycles average, %"PRIu64" cycles max.",
+       free_lat.total / free_lat.cnt, free_lat.max);
+
+  end_free = palloc_count_free (PAL_USER, NULL);
+  if (end_free != start_free)
+    fail ("%zu pages free at start but %zu at end", start_free, end_free);
+  msg ("All pages freed.");
+}
+
+/* Reports fragmentation of the user pool after OP_CNT
+   operations. */
+static void
+report_fragmentation (int op_cnt) 
+{
+  size_t largest;
+  size_t free_cnt = palloc_count_free (PAL_USER, &largest);
+
+  msg ("After %d operations: %zu pages free, longest run %zu pages, "
+       "%zu%% fragmented.", op_cnt, free_cnt, largest,
+       free_cnt > 0 ? 100 - largest * 100 / free_cnt : 0);
+}
+
+/* Records in LAT an operation that began at START. */
+static void
+record (struct latency *lat, uint64_t start) 
+{
+  uint64_t cycles = timer_cycles () - start;
+
+  lat->total += cycles;
+  if (cycles > lat->max)
+    lat->max = cycles;
+  lat->cnt++;
+}
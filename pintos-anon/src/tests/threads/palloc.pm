@@ -0,0 +1,31 @@
+sub check_palloc_bench {
+    my ($name) = @_;
+    our ($test);
+
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+    @output = get_core_output ("run", @output);
+
+    fail "missing begin message\n" if $output[0] ne "($name) begin";
+    fail "missing end message\n" if $output[$#output] ne "($name) end";
+
+    local ($_);
+    foreach (@output) {
+	fail "$_\n" if /FAIL/;
+    }
+    foreach my $ops (5000, 10000, 15000, 20000) {
+	fail "missing fragmentation report after $ops operations\n"
+	  if !grep (/^\($name\) After $ops operations: \d+ pages free, longest run \d+ pages, \d+% fragmented\.$/,
+		    @output);
+    }
+    foreach my $op ('Allocate', 'Free') {
+	fail "missing latency for \L$op\n"
+	  if !grep (/^\($name\) $op: \d+ cycles average, \d+ cycles max\.$/,
+		    @output);
+    }
+    fail "not all pages were freed\n"
+      if !grep (/^\($name\) All pages freed\.$/, @output);
+    pass;
+}
+
+1;
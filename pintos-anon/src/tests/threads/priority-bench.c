@@ -0,0 +1,94 @@
+/* Measures the cost of a context switch as the number of ready
+   threads grows.  Two threads at the highest priority yield back
+   and forth to each other while the rest of the ready threads sit
+   on the run queues at lower priorities.  With per-priority run
+   queues, the cost per switch should not depend on the number of
+   ready threads. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of round trips between the two yielding threads. */
+#define ROUND_TRIPS 10000
+
+static void bench (int ready_cnt);
+static thread_func partner_thread;
+static thread_func filler_thread;
+
+void
+test_priority_bench (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  bench (1);
+  bench (64);
+  bench (1024);
+}
+
+/* Runs the benchmark with READY_CNT threads on the run queues
+   besides the running one. */
+static void
+bench (int ready_cnt) 
+{
+  struct semaphore done;
+  uint64_t start, cycles;
+  int i;
+
+  sema_init (&done, 0);
+  thread_set_priority (PRI_MAX);
+
+  /* The partner is one of the READY_CNT ready threads, the rest
+     are fillers spread over the lower priorities. */
+  if (thread_create ("partner", PRI_MAX, partner_thread, &done)
+      == TID_ERROR)
+    fail ("could not create partner thread");
+  for (i = 1; i < ready_cnt; i++) 
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "f%d", i);
+      if (thread_create (name, i % PRI_MAX, filler_thread, &done)
+          == TID_ERROR)
+        fail ("could not create filler thread %d", i);
+    }
+
+  start = timer_cycles ();
+  for (i = 0; i < ROUND_TRIPS; i++)
+    thread_yield ();
+  cycles = timer_cycles () - start;
+
+  /* Block until every other thread has exited. */
+  for (i = 0; i < ready_cnt; i++)
+    sema_down (&done);
+  thread_set_priority (PRI_DEFAULT);
+
+  msg ("%d ready threads: %"PRIu64" cycles per switch.",
+       ready_cnt, cycles / (2 * ROUND_TRIPS));
+}
+
+/* Yields back to the main thread ROUND_TRIPS times. */
+static void
+partner_thread (void *done_) 
+{
+  struct semaphore *done = done_;
+  int i;
+
+  for (i = 0; i < ROUND_TRIPS; i++)
+    thread_yield ();
+  sema_up (done);
+}
+
+/* Sits on a run queue until the main thread blocks. */
+static void
+filler_thread (void *done_) 
+{
+  struct semaphore *done = done_;
+
+  sema_up (done);
+}
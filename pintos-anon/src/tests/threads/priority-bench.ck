@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "missing begin message\n" if $output[0] ne '(priority-bench) begin';
+fail "missing end message\n" if $output[$#output] ne '(priority-bench) end';
+
+foreach my $cnt (1, 64, 1024) {
+    fail "missing result for $cnt ready threads\n"
+      if !grep (/^\(priority-bench\) $cnt ready threads: \d+ cycles per switch\.$/,
+		@output);
+}
+pass;
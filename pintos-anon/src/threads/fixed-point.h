@@ -0,0 +1,62 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* Signed 17.14 fixed-point arithmetic, as used by the
+   multi-level feedback queue scheduler.  The kernel does not
+   support floating point, so real numbers are represented as
+   integers scaled by FP_F: 1 sign bit, 17 integer bits, and 14
+   fraction bits.  Only multiplication and division of two
+   fixed-point numbers need 64-bit intermediates. */
+typedef int32_t fixed_point_t;
+
+/* Number of fraction bits. */
+#define FP_SHIFT 14
+
+/* The fixed-point representation of 1. */
+#define FP_F (1 << FP_SHIFT)
+
+/* Converts integer N to fixed point. */
+static inline fixed_point_t
+fp_from_int (int n) 
+{
+  return n * FP_F;
+}
+
+/* Converts X to an integer, rounding toward zero. */
+static inline int
+fp_trunc (fixed_point_t x) 
+{
+  return x / FP_F;
+}
+
+/* Converts X to an integer, rounding to nearest. */
+static inline int
+fp_round (fixed_point_t x) 
+{
+  return x >= 0 ? (x + FP_F / 2) / FP_F : (x - FP_F / 2) / FP_F;
+}
+
+/* Returns X + N. */
+static inline fixed_point_t
+fp_add_int (fixed_point_t x, int n) 
+{
+  return x + n * FP_F;
+}
+
+/* Returns X * Y. */
+static inline fixed_point_t
+fp_mul (fixed_point_t x, fixed_point_t y) 
+{
+  return (int64_t) x * y / FP_F;
+}
+
+/* Returns X / Y. */
+static inline fixed_point_t
+fp_div (fixed_point_t x, fixed_point_t y) 
+{
+  return (int64_t) x * FP_F / y;
+}
+
+#endif /* threads/fixed-point.h */
@@ -21,6 +21,7 @@
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -31,11 +32,17 @@
 #else
 #include "tests/threads/tests.h"
 #endif
+#ifdef FILESYS_TESTS
+#include "tests/filesys/kernel/tests.h"
+#endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -97,6 +104,7 @@ main (void)
   /* Initialize memory system. */
   palloc_init (user_page_limit);
   malloc_init ();
+  kmem_init ();
   paging_init ();
 
   /* Segmentation. */
@@ -247,6 +255,12 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        cache_size = atoi (value);
+      else if (!strcmp (name, "-extents"))
+        inode_extents = true;
+      else if (!strcmp (name, "-defer-free-map"))
+        free_map_defer = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -254,8 +268,16 @@ parse_options (char **argv)
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
+      else if (!strcmp (name, "-first-fit"))
+        palloc_first_fit = true;
+      else if (!strcmp (name, "-no-magazines"))
+        malloc_magazines = false;
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-schedtrace"))
+        thread_sched_trace = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -292,6 +314,19 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+#ifdef FILESYS_TESTS
+/* Runs the test built into the kernel named in ARGV[1]. */
+static void
+run_kernel_test (char **argv)
+{
+  const char *test = argv[1];
+
+  printf ("Executing '%s':\n", test);
+  run_test (test);
+  printf ("Execution of '%s' complete.\n", test);
+}
+#endif
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -315,6 +350,9 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+#endif
+#ifdef FILESYS_TESTS
+      {"test", 2, run_kernel_test},
 #endif
       {NULL, 0, NULL},
     };
@@ -364,6 +402,9 @@ usage (void)
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
+#endif
+#ifdef FILESYS_TESTS
+          "  test TEST          Run TEST, built into the kernel.\n"
 #endif
           "\nOptions:\n"
           "  -h                 Print this help message and power off.\n"
@@ -373,12 +414,19 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=SECTORS     Cache SECTORS sectors of the file system.\n"
+          "  -extents           Create files with extent-based inodes.\n"
+          "  -defer-free-map    Write free map only at shutdown (unsafe).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
+          "  -first-fit         Allocate pages first fit, not by buddy system.\n"
+          "  -no-magazines      Do not cache free malloc() blocks per thread.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the timer tick while idle.\n"
+          "  -schedtrace        Dump scheduling trace at shutdown and panic.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
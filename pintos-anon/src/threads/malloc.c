@@ -7,6 +7,7 @@
 #include <string.h>
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -32,7 +33,20 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   Taking a descriptor's lock for every block is expensive, and
+   threads that allocate at the same time end up waiting for each
+   other.  So, each thread keeps a "magazine" of free blocks for
+   each descriptor in its struct thread.  malloc() takes a block
+   from the running thread's magazine and free() puts one back,
+   without any locking, because no other thread touches the
+   magazine.  An empty magazine is refilled with several blocks
+   at once from the descriptor's free list, and a full one is
+   half emptied back into it, so the lock is taken only once per
+   batch.  Blocks in magazines count as in use as far as their
+   arenas are concerned.  A thread's magazines are emptied when
+   it exits. */
 
 /* Descriptor. */
 struct desc
@@ -61,11 +75,24 @@ struct block
   };
 
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[MAGAZINE_CNT];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Bytes of free blocks that a magazine holds at most, and the
+   bounds on its capacity in blocks. */
+#define MAGAZINE_BYTES 2048
+#define MAGAZINE_MIN 4
+#define MAGAZINE_MAX 32
+
+/* If false, do not use magazines.
+   Controlled by kernel command-line option "-no-magazines". */
+bool malloc_magazines = true;
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *desc_get (struct desc *);
+static void desc_put (struct desc *, struct block *);
+static size_t magazine_capacity (const struct desc *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -76,7 +103,7 @@ malloc_init (void)
   for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
     {
       struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+      ASSERT (desc_cnt <= MAGAZINE_CNT);
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
@@ -119,36 +146,33 @@ malloc (size_t size)
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
+  if (malloc_magazines) 
     {
-      size_t i;
+      struct magazine *m = &thread_current ()->magazines[d - descs];
 
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL) 
+      /* If the magazine is empty, refill half of it. */
+      if (m->cnt == 0) 
         {
+          size_t batch = magazine_capacity (d) / 2;
+
+          lock_acquire (&d->lock);
+          while (m->cnt < batch && (b = desc_get (d)) != NULL) 
+            {
+              list_push_back (&m->blocks, &b->free_elem);
+              m->cnt++;
+            }
           lock_release (&d->lock);
-          return NULL; 
-        }
 
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
+          if (m->cnt == 0)
+            return NULL;
         }
+
+      m->cnt--;
+      return list_entry (list_pop_front (&m->blocks), struct block, free_elem);
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
+  lock_acquire (&d->lock);
+  b = desc_get (d);
   lock_release (&d->lock);
   return b;
 }
@@ -232,26 +256,31 @@ free (void *p)
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          if (malloc_magazines) 
             {
-              size_t i;
+              struct magazine *m = &thread_current ()->magazines[d - descs];
+              size_t capacity = magazine_capacity (d);
 
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
+              /* Add block to the magazine.  If that overfills it,
+                 empty half of it. */
+              list_push_front (&m->blocks, &b->free_elem);
+              if (++m->cnt > capacity) 
                 {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
+                  lock_acquire (&d->lock);
+                  while (m->cnt > capacity / 2) 
+                    {
+                      desc_put (d, list_entry (list_pop_back (&m->blocks),
+                                               struct block, free_elem));
+                      m->cnt--;
+                    }
+                  lock_release (&d->lock);
                 }
-              palloc_free_page (a);
+              return;
             }
-
+  
+          lock_acquire (&d->lock);
+          desc_put (d, b);
           lock_release (&d->lock);
         }
       else
@@ -263,6 +292,123 @@ free (void *p)
     }
 }
 
+/* Initializes magazines MAGS, for a new thread. */
+void
+malloc_init_magazines (struct magazine mags[MAGAZINE_CNT]) 
+{
+  size_t i;
+
+  for (i = 0; i < MAGAZINE_CNT; i++) 
+    {
+      list_init (&mags[i].blocks);
+      mags[i].cnt = 0;
+    }
+}
+
+/* Returns all the blocks in magazines MAGS, those of an exiting
+   thread, to their descriptors. */
+void
+malloc_drain_magazines (struct magazine mags[MAGAZINE_CNT]) 
+{
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++) 
+    {
+      struct desc *d = &descs[i];
+      struct magazine *m = &mags[i];
+
+      if (list_empty (&m->blocks))
+        continue;
+      lock_acquire (&d->lock);
+      while (!list_empty (&m->blocks))
+        desc_put (d, list_entry (list_pop_front (&m->blocks),
+                                 struct block, free_elem));
+      m->cnt = 0;
+      lock_release (&d->lock);
+    }
+}
+
+/* Removes and returns a block from descriptor D's free list,
+   creating a new arena if it is empty.  Returns a null pointer
+   if memory is not available.  D's lock must be held. */
+static struct block *
+desc_get (struct desc *d) 
+{
+  struct block *b;
+  struct arena *a;
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* If the free list is empty, create a new arena. */
+  if (list_empty (&d->free_list))
+    {
+      size_t i;
+
+      /* Allocate a page. */
+      a = palloc_get_page (0);
+      if (a == NULL) 
+        return NULL; 
+
+      /* Initialize arena and add its blocks to the free list. */
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_push_back (&d->free_list, &b->free_elem);
+        }
+    }
+
+  /* Get a block from free list. */
+  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+  a = block_to_arena (b);
+  a->free_cnt--;
+  return b;
+}
+
+/* Adds block B to descriptor D's free list, freeing its arena if
+   that leaves the arena entirely unused.  D's lock must be
+   held. */
+static void
+desc_put (struct desc *d, struct block *b) 
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      palloc_free_page (a);
+    }
+}
+
+/* Returns the number of blocks that a magazine for descriptor D
+   holds at most. */
+static size_t
+magazine_capacity (const struct desc *d) 
+{
+  size_t capacity = MAGAZINE_BYTES / d->block_size;
+
+  if (capacity < MAGAZINE_MIN)
+    return MAGAZINE_MIN;
+  if (capacity > MAGAZINE_MAX)
+    return MAGAZINE_MAX;
+  return capacity;
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
@@ -2,9 +2,26 @@
 #define THREADS_MALLOC_H
 
 #include <debug.h>
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 
+/* Number of block sizes, each with its own magazine. */
+#define MAGAZINE_CNT 7
+
+/* A thread's cache of free blocks of one size. */
+struct magazine
+  {
+    struct list blocks;         /* Free blocks. */
+    size_t cnt;                 /* Number of blocks. */
+  };
+
+/* If false, do not use magazines. */
+extern bool malloc_magazines;
+
 void malloc_init (void);
+void malloc_init_magazines (struct magazine[MAGAZINE_CNT]);
+void malloc_drain_magazines (struct magazine[MAGAZINE_CNT]);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
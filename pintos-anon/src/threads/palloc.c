@@ -1,12 +1,14 @@
 #include "threads/palloc.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <list.h>
 #include <inttypes.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -23,7 +25,46 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, pages are managed by a binary buddy allocator.
+   Free pages are kept in blocks of 2**K pages, for some "order"
+   K, that start at a multiple of 2**K pages from the pool's
+   base, with one free list per order.  A request is satisfied by
+   the smallest free block that is big enough, halving it as
+   often as possible, and the pages beyond the request are freed
+   again at once.  When a block is freed, it is merged with its
+   "buddy", the other half of the block twice its size, as long
+   as the buddy is free too.  Both take O(log n) time for a pool
+   of n pages.  The free list elements live in the free pages
+   themselves; an array with one byte per page records the order
+   of each free block, indexed by its first page.
+
+   A bitmap of the pages in use is maintained as well.  With
+   "-first-fit" on the kernel command line, the bitmap alone is
+   used, by searching it for the first run of enough free pages.
+   Otherwise, it cross-checks the buddy allocator.
+
+   Zeroing a page takes longer than allocating it, so the idle
+   thread zeroes free pages in advance, up to ZERO_WATERMARK in
+   each pool, by calling palloc_zero_idle().  A request for a
+   single page with PAL_ZERO takes one of these if there are any.
+   Pages that are waiting to be taken count as allocated, but
+   they are given back if an allocation would fail otherwise.
+   The waiting pages are protected by disabling interrupts rather
+   than by the pool's lock, because the idle thread must never
+   block. */
+
+/* Number of block orders.  The largest block, of 2**(ORDER_CNT -
+   1) pages, must be at least as big as the biggest pool. */
+#define ORDER_CNT 20
+
+/* Marks a page that does not begin a free block. */
+#define NOT_FREE 0xff
+
+/* Number of zeroed pages that the idle thread keeps ready in
+   each pool. */
+#define ZERO_WATERMARK 32
 
 /* A memory pool. */
 struct pool
@@ -31,14 +72,43 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages. */
+    uint8_t *orders;                    /* Order of block at each page. */
+    struct list free_lists[ORDER_CNT];  /* Free blocks of each order. */
+    uint32_t free_mask;                 /* Bit K set if free_lists[K]
+                                           is nonempty. */
+    const char *name;                   /* Name (for statistics). */
+
+    /* Pages zeroed in advance.  Protected by disabling
+       interrupts. */
+    void *zeroed[ZERO_WATERMARK];       /* Zeroed pages. */
+    size_t zeroed_cnt;                  /* Number of zeroed pages. */
+    long long zero_hits;                /* PAL_ZERO requests that took one. */
+    long long zero_misses;              /* PAL_ZERO requests that did not. */
   };
 
+/* A free block, stored in its own first page. */
+struct free_block
+  {
+    struct list_elem elem;              /* Element in a free list. */
+  };
+
+/* If true, use first fit instead of the buddy allocator.
+   Controlled by kernel command-line option "-first-fit". */
+bool palloc_first_fit;
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t pool_alloc (struct pool *, size_t page_cnt);
+static void pool_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void *take_zeroed (struct pool *);
+static void release_zeroed (struct pool *);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -71,32 +141,40 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
+  void *pages = NULL;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  /* The idle thread may have zeroed a page for us already. */
+  if ((flags & PAL_ZERO) && page_cnt == 1)
+    pages = take_zeroed (pool);
 
-  if (pages != NULL) 
-    {
-      if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
-    }
-  else 
+  if (pages == NULL) 
     {
-      if (flags & PAL_ASSERT)
-        PANIC ("palloc_get: out of pages");
+      lock_acquire (&pool->lock);
+      page_idx = pool_alloc (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0) 
+        {
+          release_zeroed (pool);
+          page_idx = pool_alloc (pool, page_cnt);
+        }
+      if (page_idx != BITMAP_ERROR && (flags & PAL_ZERO))
+        pool->zero_misses++;
+      lock_release (&pool->lock);
+
+      if (page_idx != BITMAP_ERROR) 
+        {
+          pages = pool->base + PGSIZE * page_idx;
+          if (flags & PAL_ZERO)
+            memset (pages, 0, PGSIZE * page_cnt);
+        }
     }
 
+  if (pages == NULL && (flags & PAL_ASSERT))
+    PANIC ("palloc_get: out of pages");
+
   return pages;
 }
 
@@ -137,8 +215,9 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  lock_acquire (&pool->lock);
+  pool_free (pool, page_idx, page_cnt);
+  lock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +227,133 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Zeroes a free page in advance for a later PAL_ZERO request, if
+   either pool has fewer than ZERO_WATERMARK zeroed pages.
+   Returns true if it zeroed a page, false if there was nothing
+   to do or the pools were busy.
+
+   Called by the idle thread, with interrupts on, when nothing
+   else is ready to run.  Never blocks: the idle thread must
+   not. */
+bool
+palloc_zero_idle (void) 
+{
+  struct pool *pools[] = {&kernel_pool, &user_pool};
+  size_t i;
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++) 
+    {
+      struct pool *p = pools[i];
+      size_t page_idx = BITMAP_ERROR;
+      enum intr_level old_level;
+      void *page;
+
+      if (p->zeroed_cnt >= ZERO_WATERMARK)
+        continue;
+
+      /* Interrupts stay off while we hold the lock, so that no
+         thread can come to wait for it and donate its priority
+         to the idle thread, which is never on a run queue. */
+      old_level = intr_disable ();
+      if (lock_try_acquire (&p->lock)) 
+        {
+          page_idx = pool_alloc (p, 1);
+          lock_release (&p->lock);
+        }
+      intr_set_level (old_level);
+      if (page_idx == BITMAP_ERROR)
+        continue;
+
+      page = p->base + PGSIZE * page_idx;
+      memset (page, 0, PGSIZE);
+
+      old_level = intr_disable ();
+      ASSERT (p->zeroed_cnt < ZERO_WATERMARK);
+      p->zeroed[p->zeroed_cnt++] = page;
+      intr_set_level (old_level);
+      return true;
+    }
+  return false;
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) 
+{
+  struct pool *pools[] = {&kernel_pool, &user_pool};
+  size_t i;
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++)
+    printf ("Palloc: %s: %lld zeroed page hits, %lld misses\n",
+            pools[i]->name, pools[i]->zero_hits, pools[i]->zero_misses);
+}
+
+/* Returns the number of free pages in the user pool, if PAL_USER
+   is set in FLAGS, or the kernel pool, otherwise.  If
+   LARGEST_RUN is nonnull, stores in it the length of the longest
+   run of contiguous free pages, so that callers can measure
+   fragmentation.  Takes time linear in the size of the pool. */
+size_t
+palloc_count_free (enum palloc_flags flags, size_t *largest_run) 
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  size_t free_cnt = 0;
+  size_t longest = 0;
+  size_t run = 0;
+  size_t i;
+
+  lock_acquire (&pool->lock);
+  for (i = 0; i < pool->page_cnt; i++)
+    if (!bitmap_test (pool->used_map, i)) 
+      {
+        free_cnt++;
+        if (++run > longest)
+          longest = run;
+      }
+    else
+      run = 0;
+  free_cnt += pool->zeroed_cnt;
+  lock_release (&pool->lock);
+
+  if (largest_run != NULL)
+    *largest_run = longest;
+  return free_cnt;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
+  /* We'll put the pool's used_map and block orders at its base.
+     Calculate the space needed for them and subtract it from the
+     pool's size. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t meta_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
+  if (meta_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  page_cnt -= meta_pages;
+  ASSERT (page_cnt < (size_t) 1 << (ORDER_CNT - 1));
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->base = base + meta_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  p->orders = (uint8_t *) base + bm_size;
+  memset (p->orders, NOT_FREE, page_cnt);
+  for (order = 0; order < ORDER_CNT; order++)
+    list_init (&p->free_lists[order]);
+  p->free_mask = 0;
+  p->name = name;
+  p->zeroed_cnt = 0;
+  p->zero_hits = p->zero_misses = 0;
+  if (!palloc_first_fit)
+    buddy_free (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -180,3 +367,182 @@ page_from_pool (const struct pool *pool, void *page)
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Allocates PAGE_CNT contiguous pages from pool P and returns the
+   index of the first one, or BITMAP_ERROR if there are not
+   enough free pages.  P's lock must be held. */
+static size_t
+pool_alloc (struct pool *p, size_t page_cnt) 
+{
+  size_t page_idx;
+
+  if (palloc_first_fit)
+    return bitmap_scan_and_flip (p->used_map, 0, page_cnt, false);
+
+  page_idx = buddy_alloc (p, page_cnt);
+  if (page_idx != BITMAP_ERROR) 
+    {
+      ASSERT (bitmap_none (p->used_map, page_idx, page_cnt));
+      bitmap_set_multiple (p->used_map, page_idx, page_cnt, true);
+    }
+  return page_idx;
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in pool P.  P's
+   lock must be held. */
+static void
+pool_free (struct pool *p, size_t page_idx, size_t page_cnt) 
+{
+  ASSERT (bitmap_all (p->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (p->used_map, page_idx, page_cnt, false);
+  if (!palloc_first_fit)
+    buddy_free (p, page_idx, page_cnt);
+}
+
+/* Removes and returns one of pool P's zeroed pages, or returns a
+   null pointer if it has none. */
+static void *
+take_zeroed (struct pool *p) 
+{
+  enum intr_level old_level = intr_disable ();
+  void *page = NULL;
+
+  if (p->zeroed_cnt > 0) 
+    {
+      page = p->zeroed[--p->zeroed_cnt];
+      p->zero_hits++;
+    }
+  intr_set_level (old_level);
+  return page;
+}
+
+/* Frees all of pool P's zeroed pages.  P's lock must be held. */
+static void
+release_zeroed (struct pool *p) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  while (p->zeroed_cnt > 0) 
+    {
+      void *page = p->zeroed[--p->zeroed_cnt];
+      pool_free (p, pg_no (page) - pg_no (p->base), 1);
+    }
+  intr_set_level (old_level);
+}
+
+/* Returns the first page of free block B in pool P. */
+static size_t
+block_to_idx (const struct pool *p, struct free_block *b) 
+{
+  return pg_no (b) - pg_no (p->base);
+}
+
+/* Returns the free block whose first page is PAGE_IDX in pool
+   P. */
+static struct free_block *
+idx_to_block (const struct pool *p, size_t page_idx) 
+{
+  return (struct free_block *) (p->base + page_idx * PGSIZE);
+}
+
+/* Adds the block of 2**ORDER pages starting at PAGE_IDX to pool
+   P's free lists. */
+static void
+push_block (struct pool *p, size_t page_idx, int order) 
+{
+  p->orders[page_idx] = order;
+  list_push_front (&p->free_lists[order], &idx_to_block (p, page_idx)->elem);
+  p->free_mask |= 1u << order;
+}
+
+/* Removes the free block of 2**ORDER pages starting at PAGE_IDX
+   from pool P's free lists. */
+static void
+remove_block (struct pool *p, size_t page_idx, int order) 
+{
+  ASSERT (p->orders[page_idx] == order);
+
+  p->orders[page_idx] = NOT_FREE;
+  list_remove (&idx_to_block (p, page_idx)->elem);
+  if (list_empty (&p->free_lists[order]))
+    p->free_mask &= ~(1u << order);
+}
+
+/* Frees the block of 2**ORDER pages starting at PAGE_IDX in pool
+   P, merging it with its buddy as many times as possible. */
+static void
+free_block (struct pool *p, size_t page_idx, int order) 
+{
+  while (order < ORDER_CNT - 1) 
+    {
+      size_t size = (size_t) 1 << order;
+      size_t buddy = page_idx ^ size;
+
+      if (buddy + size > p->page_cnt || p->orders[buddy] != order)
+        break;
+      remove_block (p, buddy, order);
+      page_idx &= ~size;
+      order++;
+    }
+  push_block (p, page_idx, order);
+}
+
+/* Allocates PAGE_CNT contiguous pages from pool P and returns the
+   index of the first one, or BITMAP_ERROR if no free block is
+   big enough.  P's lock must be held. */
+static size_t
+buddy_alloc (struct pool *p, size_t page_cnt) 
+{
+  int order = 0;
+  uint32_t avail;
+  int k;
+  size_t page_idx;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  /* Find the smallest order that fits PAGE_CNT pages, then the
+     smallest free block of at least that order. */
+  while (((size_t) 1 << order) < page_cnt)
+    if (++order >= ORDER_CNT)
+      return BITMAP_ERROR;
+  avail = p->free_mask & ~((1u << order) - 1);
+  if (avail == 0)
+    return BITMAP_ERROR;
+  k = __builtin_ctz (avail);
+
+  page_idx = block_to_idx (p, list_entry (list_front (&p->free_lists[k]),
+                                          struct free_block, elem));
+  remove_block (p, page_idx, k);
+
+  /* Split off and free the upper half until the block is of the
+     right order, then free the pages past PAGE_CNT. */
+  while (k > order) 
+    {
+      k--;
+      push_block (p, page_idx + ((size_t) 1 << k), k);
+    }
+  buddy_free (p, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+
+  return page_idx;
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in pool P, which
+   need not form a single block, by dividing them into the
+   largest possible blocks.  P's lock must be held, except at
+   initialization. */
+static void
+buddy_free (struct pool *p, size_t page_idx, size_t page_cnt) 
+{
+  while (page_cnt > 0) 
+    {
+      int order = page_idx != 0 ? __builtin_ctz (page_idx) : ORDER_CNT - 1;
+
+      if (order > ORDER_CNT - 1)
+        order = ORDER_CNT - 1;
+      while (((size_t) 1 << order) > page_cnt)
+        order--;
+      free_block (p, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
@@ -0,0 +1,359 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator, for kernel objects of a fixed type.
+
+   malloc() rounds every request up to a power of 2, which wastes
+   up to half of each block for objects whose size is just over a
+   power of 2.  An object cache instead carves pages, called
+   "slabs", into objects of exactly the size of its type, plus
+   alignment.  The slab's header sits at the beginning of its
+   page, so that kmem_cache_free() can find it by rounding the
+   object's address down.
+
+   Each cache keeps its slabs on three lists: partial slabs,
+   which have both free and allocated objects and are preferred
+   for allocation, full slabs, and empty slabs.  A few empty
+   slabs are kept to avoid returning a page to the page allocator
+   only to ask for it again at the next allocation.  The rest are
+   freed as soon as they become empty, and those that are kept
+   are freed by kmem_cache_reap() when pages run out.
+
+   A cache may have a constructor, which is run on each object
+   just once, when its slab is created.  Objects are expected to
+   be freed in their constructed state, so the free list link of
+   a free object is then placed after the object instead of over
+   its first bytes. */
+
+/* Object cache. */
+struct kmem_cache
+  {
+    char name[16];              /* Name (for statistics). */
+    size_t obj_size;            /* Size of each object, as requested. */
+    size_t stride;              /* Distance between objects in a slab. */
+    size_t link_ofs;            /* Offset of free list link in an object. */
+    size_t first_ofs;           /* Offset of first object in a slab. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or a null pointer. */
+    struct list partial_slabs;  /* Slabs with free and allocated objects. */
+    struct list full_slabs;     /* Slabs with no free objects. */
+    struct list empty_slabs;    /* Slabs with no allocated objects. */
+    size_t empty_cnt;           /* Number of empty slabs. */
+    size_t slab_cnt;            /* Number of slabs. */
+    size_t in_use;              /* Number of allocated objects. */
+    size_t peak_in_use;         /* Largest value of `in_use' so far. */
+    struct lock lock;           /* Lock. */
+    struct list_elem elem;      /* Element in `caches'. */
+  };
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab5eed
+
+/* Slab. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of the cache's lists. */
+    size_t in_use;              /* Number of allocated objects. */
+    void *free;                 /* First free object, or null. */
+  };
+
+/* Number of empty slabs that a cache keeps. */
+#define EMPTY_MAX 1
+
+/* All the caches, for kmem_cache_reap() and kmem_print_stats(). */
+static struct list caches;
+static struct lock caches_lock;
+
+static bool grow (struct kmem_cache *);
+static void reap (struct kmem_cache *, size_t keep);
+static struct slab *obj_to_slab (struct kmem_cache *, void *);
+
+/* Initializes the slab allocator. */
+void
+kmem_init (void) 
+{
+  list_init (&caches);
+  lock_init (&caches_lock);
+}
+
+/* Returns the address of the free list link in OBJ, an object
+   in cache C. */
+static inline void **
+obj_link (struct kmem_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Creates and returns a cache of objects of SIZE bytes each,
+   aligned on ALIGN-byte boundaries, which must be a power of 2
+   (0 means word alignment).  If CTOR is nonnull, it is run on
+   each object when the object's slab is created.  NAME is used
+   only for reporting statistics.
+
+   Objects must fit in a page along with the slab header.  Calls
+   malloc(), so malloc_init() must have been called.  Panics if
+   memory is not available, because caches are created at
+   initialization time.  kmem_init() must have been called. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+                   kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+  size_t slot;
+
+  if (align == 0)
+    align = sizeof (void *);
+  ASSERT (name != NULL);
+  ASSERT (size > 0);
+  ASSERT ((align & (align - 1)) == 0 && align < PGSIZE);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    PANIC ("kmem_cache_create: out of memory");
+
+  strlcpy (c->name, name, sizeof c->name);
+  c->obj_size = size;
+  c->ctor = ctor;
+  if (ctor != NULL)
+    {
+      c->link_ofs = ROUND_UP (size, sizeof (void *));
+      slot = c->link_ofs + sizeof (void *);
+    }
+  else
+    {
+      c->link_ofs = 0;
+      slot = size > sizeof (void *) ? size : sizeof (void *);
+    }
+  c->stride = ROUND_UP (slot, align);
+  c->first_ofs = ROUND_UP (sizeof (struct slab), align);
+  ASSERT (c->first_ofs + c->stride <= PGSIZE);
+  c->objs_per_slab = (PGSIZE - c->first_ofs) / c->stride;
+  list_init (&c->partial_slabs);
+  list_init (&c->full_slabs);
+  list_init (&c->empty_slabs);
+  c->empty_cnt = 0;
+  c->slab_cnt = 0;
+  c->in_use = c->peak_in_use = 0;
+  lock_init (&c->lock);
+
+  lock_acquire (&caches_lock);
+  list_push_back (&caches, &c->elem);
+  lock_release (&caches_lock);
+
+  return c;
+}
+
+/* Obtains and returns a new object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  ASSERT (c != NULL);
+
+  lock_acquire (&c->lock);
+
+  /* Use a partial slab if we can, otherwise an empty one,
+     otherwise a new one.  If there are no free pages, other
+     caches may be holding on to empty slabs. */
+  if (list_empty (&c->partial_slabs) && list_empty (&c->empty_slabs)
+      && !grow (c))
+    {
+      lock_release (&c->lock);
+      kmem_cache_reap ();
+      lock_acquire (&c->lock);
+      if (list_empty (&c->partial_slabs) && list_empty (&c->empty_slabs)
+          && !grow (c))
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+    }
+
+  if (!list_empty (&c->partial_slabs))
+    s = list_entry (list_front (&c->partial_slabs), struct slab, elem);
+  else
+    {
+      s = list_entry (list_pop_front (&c->empty_slabs), struct slab, elem);
+      c->empty_cnt--;
+      list_push_front (&c->partial_slabs, &s->elem);
+    }
+
+  /* Take the slab's first free object. */
+  obj = s->free;
+  ASSERT (obj != NULL);
+  s->free = *obj_link (c, obj);
+  if (++s->in_use == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      list_push_back (&c->full_slabs, &s->elem);
+    }
+  if (++c->in_use > c->peak_in_use)
+    c->peak_in_use = c->in_use;
+
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from cache C with
+   kmem_cache_alloc(), to C.  If C has a constructor, OBJ must be
+   in its constructed state.  Does nothing if OBJ is null. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (c, obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     the constructor's work must be preserved. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  lock_acquire (&c->lock);
+
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  list_remove (&s->elem);
+  if (--s->in_use > 0)
+    list_push_front (&c->partial_slabs, &s->elem);
+  else
+    {
+      list_push_front (&c->empty_slabs, &s->elem);
+      if (++c->empty_cnt > EMPTY_MAX)
+        reap (c, EMPTY_MAX);
+    }
+  c->in_use--;
+
+  lock_release (&c->lock);
+}
+
+/* Returns the empty slabs in every cache to the page
+   allocator. */
+void
+kmem_cache_reap (void)
+{
+  struct list_elem *e;
+
+  lock_acquire (&caches_lock);
+  for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+      lock_acquire (&c->lock);
+      reap (c, 0);
+      lock_release (&c->lock);
+    }
+  lock_release (&caches_lock);
+}
+
+/* Prints the utilization of each cache: the fraction of the
+   memory in its slabs that holds allocated objects. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      size_t bytes = c->slab_cnt * PGSIZE;
+
+      printf ("Slab \"%s\": %zu of %zu-byte objects in use (%zu peak), "
+              "%zu per slab, %zu slabs, %zu%% utilized\n",
+              c->name, c->in_use, c->obj_size, c->peak_in_use,
+              c->objs_per_slab, c->slab_cnt,
+              bytes > 0 ? c->in_use * c->obj_size * 100 / bytes : 0);
+    }
+}
+
+/* Adds a new, empty slab to cache C.  Returns true if
+   successful, false if no page is available.  C's lock must be
+   held. */
+static bool
+grow (struct kmem_cache *c)
+{
+  struct slab *s;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return false;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->in_use = 0;
+  s->free = NULL;
+
+  /* Thread the objects onto the free list in address order. */
+  for (i = c->objs_per_slab; i-- > 0; )
+    {
+      void *obj = (uint8_t *) s + c->first_ofs + i * c->stride;
+
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+
+  list_push_front (&c->empty_slabs, &s->elem);
+  c->empty_cnt++;
+  c->slab_cnt++;
+  return true;
+}
+
+/* Frees empty slabs in cache C until only KEEP remain.  C's
+   lock must be held. */
+static void
+reap (struct kmem_cache *c, size_t keep)
+{
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  while (c->empty_cnt > keep)
+    {
+      struct slab *s = list_entry (list_pop_back (&c->empty_slabs),
+                                   struct slab, elem);
+      ASSERT (s->in_use == 0);
+      s->magic = 0;
+      palloc_free_page (s);
+      c->empty_cnt--;
+      c->slab_cnt--;
+    }
+}
+
+/* Returns the slab that OBJ, an object in cache C, is inside. */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid and belongs to C. */
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+
+  /* Check that the object is properly aligned within the slab. */
+  ASSERT (pg_ofs (obj) >= c->first_ofs);
+  ASSERT ((pg_ofs (obj) - c->first_ofs) % c->stride == 0);
+
+  return s;
+}
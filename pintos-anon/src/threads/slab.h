@@ -0,0 +1,24 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <debug.h>
+#include <stddef.h>
+
+/* Object cache. */
+struct kmem_cache;
+
+/* Constructor for the objects in a cache.  Called once for each
+   object when the slab that holds it is created, not on every
+   allocation, so objects must be freed in their constructed
+   state. */
+typedef void kmem_ctor_func (void *obj);
+
+void kmem_init (void);
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      size_t align, kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *) __attribute__ ((malloc));
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_cache_reap (void);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
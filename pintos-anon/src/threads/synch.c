@@ -32,6 +32,19 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Waiters on semaphores and condition variables are kept in
+   heaps ordered by priority, so that the highest-priority
+   waiter is woken first without scanning the others.  Among
+   waiters of equal priority, the one that has waited longest is
+   woken first, as ordered by `wait_seq'. */
+static unsigned next_wait_seq;
+
+static bool waiter_less (const struct heap_elem *,
+                         const struct heap_elem *, void *aux);
+static void waiter_push (struct heap *, struct thread *);
+static struct thread *waiter_pop (struct heap *);
+static void donate_priority (struct thread *);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -47,12 +60,15 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  heap_init (&sema->waiters, waiter_less, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
    to become positive and then atomically decrements it.
 
+   If the running thread is acquiring a lock, it donates its
+   priority to the lock's holder each time it has to wait.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but if it sleeps then the next scheduled
@@ -60,6 +76,7 @@ sema_init (struct semaphore *sema, unsigned value)
 void
 sema_down (struct semaphore *sema) 
 {
+  struct thread *cur = thread_current ();
   enum intr_level old_level;
 
   ASSERT (sema != NULL);
@@ -68,7 +85,9 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
+      waiter_push (&sema->waiters, cur);
+      if (cur->wait_lock != NULL && !thread_mlfqs)
+        donate_priority (cur);
       thread_block ();
     }
   sema->value--;
@@ -102,7 +121,8 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any.
 
    This function may be called from an interrupt handler. */
 void
@@ -113,11 +133,13 @@ sema_up (struct semaphore *sema)
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-  if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+  if (!heap_empty (&sema->waiters)) 
+    thread_unblock (waiter_pop (&sema->waiters));
   sema->value++;
   intr_set_level (old_level);
+
+  /* Let the thread we woke run right away if it outranks us. */
+  thread_yield_to_higher ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -185,6 +207,10 @@ lock_init (struct lock *lock)
    necessary.  The lock must not already be held by the current
    thread.
 
+   While waiting, the running thread donates its priority to the
+   lock's holder, and onward along the chain of locks that the
+   holder is waiting for, up to DONATION_DEPTH_MAX locks deep.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -192,12 +218,20 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  cur->wait_lock = lock;
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  cur->wait_lock = NULL;
+  lock->holder = cur;
+  list_push_back (&cur->held_locks, &lock->elem);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -209,18 +243,26 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
-  if (success)
-    lock->holder = thread_current ();
+  if (success) 
+    {
+      lock->holder = thread_current ();
+      list_push_back (&lock->holder->held_locks, &lock->elem);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
+   Gives up any priority donated through LOCK, and yields if that
+   leaves a higher-priority thread ready to run.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
@@ -228,11 +270,21 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  list_remove (&lock->elem);
   lock->holder = NULL;
+  if (!thread_mlfqs)
+    thread_update_priority (cur);
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
+
+  thread_yield_to_higher ();
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -246,12 +298,44 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
-struct semaphore_elem 
-  {
-    struct list_elem elem;              /* List element. */
-    struct semaphore semaphore;         /* This semaphore. */
-  };
+/* Returns the priority of the highest-priority thread waiting
+   for LOCK, or PRI_MIN if there is none.  Interrupts must be
+   off. */
+int
+lock_max_waiter_priority (const struct lock *lock) 
+{
+  const struct heap *waiters = &lock->semaphore.waiters;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (heap_empty (waiters))
+    return PRI_MIN;
+  return heap_entry (heap_top (waiters), struct thread, wait_elem)->priority;
+}
+
+/* Donates T's priority to the holder of the lock that T is
+   waiting for, and so on along the chain of locks that each
+   holder is itself waiting for, stopping after
+   DONATION_DEPTH_MAX locks or at a holder whose priority is
+   already at least as high.  Interrupts must be off. */
+static void
+donate_priority (struct thread *t) 
+{
+  struct lock *lock = t->wait_lock;
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; lock != NULL && depth < DONATION_DEPTH_MAX; depth++) 
+    {
+      struct thread *holder = lock->holder;
+
+      if (holder == NULL || holder->priority >= t->priority)
+        break;
+      thread_donate_priority (holder, t->priority);
+      lock = holder->wait_lock;
+    }
+}
 
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
@@ -261,7 +345,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  heap_init (&cond->waiters, waiter_less, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -287,23 +371,29 @@ cond_init (struct condition *cond)
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
-  struct semaphore_elem waiter;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
   
-  sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
+  /* Waiters block directly on COND, rather than each on a
+     semaphore of its own, so that COND's heap always holds the
+     waiting threads themselves and follows their priorities. */
+  old_level = intr_disable ();
+  waiter_push (&cond->waiters, thread_current ());
   lock_release (lock);
-  sema_down (&waiter.semaphore);
+  thread_block ();
+  intr_set_level (old_level);
+
   lock_acquire (lock);
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
-   LOCK must be held before calling this function.
+   this function signals the highest-priority one to wake up
+   from its wait.  LOCK must be held before calling this
+   function.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to signal a condition variable within an
@@ -311,14 +401,20 @@ cond_wait (struct condition *cond, struct lock *lock)
 void
 cond_signal (struct condition *cond, struct lock *lock UNUSED) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+  /* The woken thread cannot proceed until it reacquires LOCK, so
+     there is no point in yielding to it here: lock_release()
+     will do that. */
+  old_level = intr_disable ();
+  if (!heap_empty (&cond->waiters)) 
+    thread_unblock (waiter_pop (&cond->waiters));
+  intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -333,6 +429,144 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!heap_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK.  A reader-writer lock can be held by any
+   number of readers at once or by a single writer.  Once a
+   writer is waiting, new readers wait too, so that a steady
+   stream of readers cannot keep writers out forever.  A
+   reader-writer lock is not recursive: the holder must not try
+   to acquire it again. */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->readers);
+  cond_init (&rwlock->writers);
+  rwlock->reader_cnt = 0;
+  rwlock->writer_cnt = 0;
+  rwlock->writer = NULL;
+}
+
+/* Acquires RWLOCK for reading, sleeping until no writer holds it
+   or is waiting for it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rwlock->writer != thread_current ());
+
+  lock_acquire (&rwlock->lock);
+  while (rwlock->writer != NULL || rwlock->writer_cnt > 0)
+    cond_wait (&rwlock->readers, &rwlock->lock);
+  rwlock->reader_cnt++;
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other thread
+   holds it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rwlock->writer != thread_current ());
+
+  lock_acquire (&rwlock->lock);
+  rwlock->writer_cnt++;
+  while (rwlock->writer != NULL || rwlock->reader_cnt > 0)
+    cond_wait (&rwlock->writers, &rwlock->lock);
+  rwlock->writer_cnt--;
+  rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold, for
+   reading or for writing, whichever it acquired it for.  Wakes
+   a waiting writer, if any, when the last holder releases it,
+   or else all of the waiting readers. */
+void
+rwlock_release (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  if (rwlock->writer == thread_current ())
+    rwlock->writer = NULL;
+  else
+    {
+      ASSERT (rwlock->reader_cnt > 0);
+      rwlock->reader_cnt--;
+    }
+  if (rwlock->writer == NULL && rwlock->reader_cnt == 0)
+    {
+      if (rwlock->writer_cnt > 0)
+        cond_signal (&rwlock->writers, &rwlock->lock);
+      else
+        cond_broadcast (&rwlock->readers, &rwlock->lock);
+    }
+  lock_release (&rwlock->lock);
+}
+
+/* Returns true if the current thread holds RWLOCK for writing,
+   false otherwise.  (Readers are not tracked, so there is no
+   way to tell whether the current thread holds it for
+   reading.) */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  return rwlock->writer == thread_current ();
+}
+
+/* Returns true if the thread waiting in A should be woken up
+   after the one waiting in B: if its priority is lower, or if
+   it is equal and it started waiting later. */
+static bool
+waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+             void *aux UNUSED) 
+{
+  const struct thread *a = heap_entry (a_, struct thread, wait_elem);
+  const struct thread *b = heap_entry (b_, struct thread, wait_elem);
+
+  if (a->priority != b->priority)
+    return a->priority < b->priority;
+  return (int) (a->wait_seq - b->wait_seq) > 0;
+}
+
+/* Adds T to WAITERS.  Interrupts must be off. */
+static void
+waiter_push (struct heap *waiters, struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t->wait_seq = next_wait_seq++;
+  t->wait_heap = waiters;
+  heap_push (waiters, &t->wait_elem);
+}
+
+/* Removes and returns the thread in WAITERS that should be woken
+   up first.  Interrupts must be off. */
+static struct thread *
+waiter_pop (struct heap *waiters) 
+{
+  struct thread *t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t = heap_entry (heap_pop (waiters), struct thread, wait_elem);
+  t->wait_heap = NULL;
+  return t;
+}
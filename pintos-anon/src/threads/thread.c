@@ -7,10 +7,12 @@
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -20,11 +22,15 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-
-
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queues of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO queue per priority, and bit P of ready_mask
+   is set if and only if ready_queues[P] is nonempty, so that
+   both finding the highest-priority ready thread and queuing a
+   thread take constant time. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static unsigned ready_cnt;      /* # of threads in the run queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -61,17 +67,81 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Multi-level feedback queue scheduler state.
+
+   Once per second, every thread's recent_cpu decays by a factor
+   that depends on the load average at that moment.  Rather than
+   visiting every thread, the per-second update only visits the
+   running thread and the ready threads.  Blocked threads cannot
+   be scheduled, so their recent_cpu is brought up to date when
+   they are unblocked, by replaying the decay factors recorded in
+   decay_history for each second that they missed.  A thread
+   blocked for longer than DECAY_HISTORY seconds skips the oldest
+   decays; by then the others have made them negligible. */
+#define DECAY_HISTORY 512       /* Must be a power of 2. */
+static fixed_point_t load_avg;  /* System load average. */
+static int64_t mlfqs_epoch;     /* # of per-second updates so far. */
+static fixed_point_t decay_history[DECAY_HISTORY];
+
+/* Why a thread switch happened. */
+enum switch_reason
+  {
+    SWITCH_BLOCK,               /* Running thread blocked. */
+    SWITCH_YIELD,               /* Running thread yielded. */
+    SWITCH_PREEMPT,             /* Running thread was preempted. */
+    SWITCH_EXIT                 /* Running thread exited. */
+  };
+
+/* Trace of the most recent thread switches, for post-mortem
+   debugging.  Each switch overwrites the oldest event.  Events
+   are only written by schedule(), which runs with interrupts
+   off, so on our single CPU no lock is needed, and a reader that
+   has interrupts off, such as debug_panic(), always sees a
+   consistent trace. */
+#define TRACE_SIZE 64           /* Must be a power of 2. */
+struct switch_event
+  {
+    int64_t tick;               /* timer_ticks() at the switch. */
+    tid_t prev;                 /* Thread switched from. */
+    tid_t next;                 /* Thread switched to. */
+    enum switch_reason reason;  /* Why. */
+  };
+static struct switch_event switch_trace[TRACE_SIZE];
+static unsigned long long switch_cnt;   /* # of switches so far. */
+
+/* If true, dump the per-thread scheduling statistics and the
+   recent thread switches at shutdown and on kernel panic.
+   Controlled by kernel command-line option "-schedtrace". */
+bool thread_sched_trace;
+
+/* Statistics for the per-second update. */
+static long long mlfqs_updates;         /* # of updates. */
+static uint64_t mlfqs_update_cycles;    /* Total cycles spent. */
+static uint64_t mlfqs_update_max;       /* Longest update, in cycles. */
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
+static void change_priority (struct thread *, int priority);
 static void *alloc_frame (struct thread *, size_t size);
-static void schedule (void);
+static void yield (enum switch_reason);
+static void schedule (enum switch_reason);
+static void account_switch (struct thread *cur, struct thread *next,
+                            enum switch_reason);
+static void print_thread_stats (struct thread *, void *aux);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_update_second (struct thread *);
+static void mlfqs_catch_up (struct thread *);
+static int mlfqs_priority (const struct thread *);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -89,13 +159,15 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int pri;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    list_init (&ready_queues[pri]);
   list_init (&all_list);
 
-
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
@@ -129,6 +201,7 @@ thread_tick (void)
   struct thread *t = thread_current ();
 
   /* Update statistics. */
+  t->run_ticks++;
   if (t == idle_thread)
     idle_ticks++;
 #ifdef USERPROG
@@ -138,8 +211,14 @@ thread_tick (void)
   else
     kernel_ticks++;
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
+  /* Enforce preemption.  The idle thread gives up the CPU by
+     itself as soon as anything else is ready, and in tickless
+     mode it may run this function outside of interrupt context
+     to catch up on ticks that passed while it was halted. */
+  if (++thread_ticks >= TIME_SLICE && t != idle_thread)
     intr_yield_on_return ();
 }
 
@@ -149,6 +228,49 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  if (thread_mlfqs && mlfqs_updates > 0)
+    printf ("MLFQS: %lld per-second updates, "
+            "%llu cycles average, %llu cycles max\n",
+            mlfqs_updates, mlfqs_update_cycles / mlfqs_updates,
+            mlfqs_update_max);
+  if (thread_sched_trace)
+    thread_print_trace ();
+}
+
+/* Prints every thread's scheduling statistics, followed by the
+   most recent thread switches, oldest first.  Called at shutdown
+   and by debug_panic(), so it is careful not to block. */
+void
+thread_print_trace (void) 
+{
+  static const char *reasons[] = {"block", "yield", "preempt", "exit"};
+  enum intr_level old_level = intr_disable ();
+  unsigned long long i;
+
+  printf ("Scheduling statistics (cycles):\n");
+  thread_foreach (print_thread_stats, NULL);
+
+  printf ("Last %llu of %llu thread switches:\n",
+          switch_cnt < TRACE_SIZE ? switch_cnt : TRACE_SIZE, switch_cnt);
+  for (i = switch_cnt < TRACE_SIZE ? 0 : switch_cnt - TRACE_SIZE;
+       i < switch_cnt; i++) 
+    {
+      struct switch_event *e = &switch_trace[i & (TRACE_SIZE - 1)];
+      printf ("  tick %lld: %d -> %d (%s)\n",
+              e->tick, e->prev, e->next, reasons[e->reason]);
+    }
+  intr_set_level (old_level);
+}
+
+/* Prints thread T's scheduling statistics. */
+static void
+print_thread_stats (struct thread *t, void *aux UNUSED) 
+{
+  printf ("  %d %s: %lld ticks run, %u voluntary and %u involuntary "
+          "switches, %llu ready, %llu blocked, %llu max wakeup latency\n",
+          t->tid, t->name, t->run_ticks,
+          t->voluntary_switches, t->involuntary_switches,
+          t->ready_cycles, t->blocked_cycles, t->max_wakeup_latency);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -163,9 +285,9 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread has a higher priority than the running
+   thread, it preempts the running thread before this function
+   returns. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -221,30 +343,46 @@ thread_block (void)
   ASSERT (intr_get_level () == INTR_OFF);
 
   thread_current ()->status = THREAD_BLOCKED;
-  schedule ();
+  schedule (SWITCH_BLOCK);
 }
 
 /* Transitions a blocked thread T to the ready-to-run state.
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   If T has a higher priority than the running thread, the
+   running thread is preempted, but only if that is safe: in an
+   interrupt handler, the switch happens when the handler
+   returns, and if the caller had disabled interrupts itself, it
+   may expect that it can atomically unblock a thread and update
+   other data, so the caller must call thread_yield_to_higher()
+   once it re-enables interrupts. */
 void
 thread_unblock (struct thread *t) 
 {
   enum intr_level old_level;
+  uint64_t now;
 
   ASSERT (is_thread (t));
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  if (thread_mlfqs && t != idle_thread) 
+    {
+      mlfqs_catch_up (t);
+      t->priority = mlfqs_priority (t);
+    }
+  ready_push (t);
   t->status = THREAD_READY;
   t->wake_tm = 0;
+  now = timer_cycles ();
+  t->blocked_cycles += now - t->status_cycles;
+  t->status_cycles = now;
+  t->woken = true;
   intr_set_level (old_level);
+
+  if (old_level == INTR_ON || intr_context ())
+    thread_yield_to_higher ();
 }
 
 /* Returns the name of the running thread. */
@@ -290,6 +428,7 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  malloc_drain_magazines (thread_current ()->magazines);
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -297,7 +436,7 @@ thread_exit (void)
   intr_disable ();
   list_remove (&thread_current()->allelem);
   thread_current ()->status = THREAD_DYING;
-  schedule ();
+  schedule (SWITCH_EXIT);
   NOT_REACHED ();
 }
 
@@ -306,17 +445,41 @@ thread_exit (void)
 void
 thread_yield (void) 
 {
-  struct thread *cur = thread_current ();
+  yield (SWITCH_YIELD);
+}
+
+/* Like thread_yield(), but the running thread is giving up the
+   CPU against its will, because its time slice expired or a
+   higher-priority thread became ready.  Differs only in how the
+   switch is accounted for. */
+void
+thread_preempt (void) 
+{
+  yield (SWITCH_PREEMPT);
+}
+
+/* Yields the CPU if some ready thread has a higher priority than
+   the running thread.  In an interrupt handler, arranges to
+   yield just before the handler returns instead.  Does nothing
+   if interrupts are off outside an interrupt handler, because
+   then the caller is in a critical section. */
+void
+thread_yield_to_higher (void)
+{
   enum intr_level old_level;
-  
-  ASSERT (!intr_context ());
+  bool yield;
 
   old_level = intr_disable ();
-  if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
-  cur->status = THREAD_READY;
-  schedule ();
+  yield = (idle_thread != NULL
+           && ready_max_priority () > thread_current ()->priority);
   intr_set_level (old_level);
+
+  if (!yield)
+    return;
+  if (intr_context ())
+    intr_yield_on_return ();
+  else if (old_level == INTR_ON)
+    thread_preempt ();
 }
 
 /* Invoke function 'func' on all threads, passing along 'aux'.
@@ -336,66 +499,134 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY.  Its
+   effective priority stays higher while other threads donate a
+   higher priority to it.  Yields if that leaves some ready
+   thread with a higher priority.
+
+   The multi-level feedback queue scheduler computes priorities
+   itself, so this function does nothing in that mode. */
 void
 thread_set_priority (int new_priority) 
 {
-       enum intr_level old_level = intr_disable();
-       thread_current ()->priority = new_priority;
-       intr_set_level(old_level);  
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  thread_current ()->base_priority = new_priority;
+  thread_update_priority (thread_current ());
+  intr_set_level (old_level);
+
+  thread_yield_to_higher ();
+}
+
+/* Raises T's priority to PRIORITY, which a thread waiting for a
+   lock that T holds is donating to it, unless T's priority is
+   already at least that high.  Interrupts must be off. */
+void
+thread_donate_priority (struct thread *t, int priority) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (is_thread (t));
+
+  if (priority > t->priority)
+    change_priority (t, priority);
+}
+
+/* Recomputes T's priority as the greater of its base priority
+   and the priorities donated by threads waiting for the locks
+   that T holds.  Interrupts must be off. */
+void
+thread_update_priority (struct thread *t) 
+{
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (is_thread (t));
+
+  for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+       e = list_next (e))
+    {
+      int donated = lock_max_waiter_priority (list_entry (e, struct lock,
+                                                          elem));
+      if (donated > priority)
+        priority = donated;
+    }
+  if (priority != t->priority)
+    change_priority (t, priority);
 }
 
 /* Returns the current thread's priority. */
 int
 thread_get_priority (void) 
 {
-     enum intr_level old_level = intr_disable();
-     int r = thread_current()->priority;
-     intr_set_level(old_level);  
-     return r;
+  enum intr_level old_level = intr_disable ();
+  int priority = thread_current ()->priority;
+  intr_set_level (old_level);
+  return priority;
 }
 
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    cur->priority = mlfqs_priority (cur);
+  intr_set_level (old_level);
+
+  thread_yield_to_higher ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu = fp_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+  return recent_cpu;
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
-   The idle thread is initially put on the ready list by
+   The idle thread is initially put on a run queue by
    thread_start().  It will be scheduled once initially, at which
    point it initializes idle_thread, "up"s the semaphore passed
    to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   blocks.  After that, the idle thread never appears in the run
+   queues.  It is returned by next_thread_to_run() as a special
+   case when the run queues are empty. */
 static void
 idle (void *idle_started_ UNUSED) 
 {
@@ -409,6 +640,20 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else is ready to run, so zero free pages in advance
+         for palloc_get_page(), with interrupts on, until something
+         is.  If something became ready meanwhile, let it run. */
+      intr_enable ();
+      while (ready_cnt == 0 && palloc_zero_idle ())
+        continue;
+      intr_disable ();
+      if (ready_cnt > 0)
+        continue;
+
+      /* In tickless mode, stop the periodic timer interrupt until
+         some sleeping thread is due. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -422,6 +667,10 @@ idle (void *idle_started_ UNUSED)
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
          7.11.1 "HLT Instruction". */
       asm volatile ("sti; hlt" : : : "memory");
+
+      /* If something other than the timer woke us up, account for
+         the ticks that passed while we were halted. */
+      timer_idle_exit ();
     }
 }
 
@@ -467,20 +716,75 @@ init_thread (struct thread *t, const char *name, int priority)
   ASSERT (t != NULL);
   ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
   ASSERT (name != NULL);
-     t->wake_tm = 0;//set the sleep time to zero.
   memset (t, 0, sizeof *t);
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  list_init (&t->held_locks);
+  malloc_init_magazines (t->magazines);
+  t->status_cycles = timer_cycles ();
   t->magic = THREAD_MAGIC;
 
+  /* A new thread inherits its parent's niceness and recent CPU
+     use.  (The initial thread is its own parent here, and starts
+     from zero.) */
+  if (thread_mlfqs) 
+    {
+      struct thread *parent = running_thread ();
+
+      t->nice = parent->nice;
+      t->recent_cpu = parent->recent_cpu;
+      t->cpu_epoch = mlfqs_epoch;
+      t->priority = mlfqs_priority (t);
+    }
+
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
   intr_set_level (old_level);
 }
 
 
+/* Sets T's effective priority to PRIORITY and moves T to match
+   within whatever queue it is in.  Interrupts must be off. */
+static void
+change_priority (struct thread *t, int priority) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  if (t->status == THREAD_READY && t != idle_thread) 
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else 
+    {
+      t->priority = priority;
+      if (t->status == THREAD_BLOCKED && t->wait_heap != NULL)
+        heap_update (t->wait_heap, &t->wait_elem);
+    }
+}
+
+/* Makes the running thread ready and schedules, giving REASON as
+   the reason for the switch. */
+static void
+yield (enum switch_reason reason) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (cur != idle_thread) 
+    ready_push (cur);
+  cur->status = THREAD_READY;
+  schedule (reason);
+  intr_set_level (old_level);
+}
+
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
    returns a pointer to the frame's base. */
 static void *
@@ -494,18 +798,72 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
+/* Adds ready thread T to the back of the run queue for its
+   priority.  Interrupts must be off. */
+static void
+ready_push (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Removes ready thread T from its run queue.  Interrupts must be
+   off. */
+static void
+ready_remove (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_mask &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   -1 if no thread is ready.  Interrupts must be off. */
+static int
+ready_max_priority (void) 
+{
+  uint32_t high = ready_mask >> 32;
+  uint32_t low = ready_mask;
+
+  /* Each half is searched separately, because a 64-bit
+     __builtin_clzll() would need a libgcc helper. */
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else if (low != 0)
+    return 31 - __builtin_clz (low);
+  else
+    return -1;
+}
+
 /* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   return a thread from the highest-priority nonempty run queue,
+   unless all the run queues are empty.  (If the running thread
+   can continue running, then it will be in a run queue.)  If
+   the run queues are empty, return idle_thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int pri = ready_max_priority ();
+  struct list *queue;
+  struct thread *t;
+
+  if (pri < 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  queue = &ready_queues[pri];
+  t = list_entry (list_pop_front (queue), struct thread, elem);
+  if (list_empty (queue))
+    ready_mask &= ~((uint64_t) 1 << pri);
+  ready_cnt--;
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -531,6 +889,23 @@ thread_schedule_tail (struct thread *prev)
   
   ASSERT (intr_get_level () == INTR_OFF);
 
+  /* Account for the time we spent waiting to run.  The idle
+     thread runs straight from the blocked state. */
+  if (prev != NULL) 
+    {
+      uint64_t now = timer_cycles ();
+      uint64_t waited = now - cur->status_cycles;
+
+      if (cur->status == THREAD_READY)
+        cur->ready_cycles += waited;
+      else
+        cur->blocked_cycles += waited;
+      if (cur->woken && waited > cur->max_wakeup_latency)
+        cur->max_wakeup_latency = waited;
+      cur->woken = false;
+      cur->status_cycles = now;
+    }
+
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
 
@@ -557,12 +932,13 @@ thread_schedule_tail (struct thread *prev)
 /* Schedules a new process.  At entry, interrupts must be off and
    the running process's state must have been changed from
    running to some other state.  This function finds another
-   thread to run and switches to it.
+   thread to run and switches to it.  REASON says why the running
+   process stopped running.
 
    It's not safe to call printf() until thread_schedule_tail()
    has completed. */
 static void
-schedule (void) 
+schedule (enum switch_reason reason) 
 {
   struct thread *cur = running_thread ();
   struct thread *next = next_thread_to_run ();
@@ -572,11 +948,38 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
-  if (cur != next)
-    prev = switch_threads (cur, next);
+  if (cur != next) 
+    {
+      account_switch (cur, next, reason);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
+/* Records in CUR's statistics and in the switch trace that CUR,
+   the running thread, is giving up the CPU to NEXT for REASON.
+   NEXT's statistics are brought up to date by
+   thread_schedule_tail() once it is running. */
+static void
+account_switch (struct thread *cur, struct thread *next,
+                enum switch_reason reason) 
+{
+  struct switch_event *e = &switch_trace[switch_cnt++ & (TRACE_SIZE - 1)];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (reason == SWITCH_PREEMPT)
+    cur->involuntary_switches++;
+  else if (reason != SWITCH_EXIT)
+    cur->voluntary_switches++;
+  cur->status_cycles = timer_cycles ();
+
+  e->tick = timer_ticks ();
+  e->prev = cur->tid;
+  e->next = next->tid;
+  e->reason = reason;
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) 
@@ -591,6 +994,108 @@ allocate_tid (void)
   return tid;
 }
 
+/* Does the multi-level feedback queue scheduler's work for a
+   timer tick, during which CUR was running.  Only CUR's
+   recent_cpu changes from one tick to the next, so only its
+   priority needs recomputing between the per-second updates. */
+static void
+mlfqs_tick (struct thread *cur) 
+{
+  int64_t now = timer_ticks ();
+
+  if (cur != idle_thread)
+    cur->recent_cpu = fp_add_int (cur->recent_cpu, 1);
+
+  if (now % TIMER_FREQ == 0)
+    mlfqs_update_second (cur);
+  else if (now % 4 == 0 && cur != idle_thread)
+    cur->priority = mlfqs_priority (cur);
+  else
+    return;
+
+  thread_yield_to_higher ();
+}
+
+/* Once-per-second update of the load average, and of the
+   recent_cpu and priority of the running thread CUR and of every
+   ready thread.  Blocked threads are caught up lazily by
+   mlfqs_catch_up(). */
+static void
+mlfqs_update_second (struct thread *cur) 
+{
+  uint64_t start = timer_cycles ();
+  uint64_t elapsed;
+  int running = cur != idle_thread ? 1 : 0;
+  fixed_point_t twice_load;
+  struct list pending;
+  int pri;
+
+  load_avg = (59 * load_avg + fp_from_int (ready_cnt + running)) / 60;
+  twice_load = 2 * load_avg;
+  decay_history[mlfqs_epoch & (DECAY_HISTORY - 1)]
+    = fp_div (twice_load, fp_add_int (twice_load, 1));
+  mlfqs_epoch++;
+
+  if (running) 
+    {
+      mlfqs_catch_up (cur);
+      cur->priority = mlfqs_priority (cur);
+    }
+
+  /* Empty the run queues, highest priority first, then requeue
+     each thread according to its new priority.  Threads that
+     share a queue afterward keep their relative order. */
+  list_init (&pending);
+  for (pri = PRI_MAX; pri >= PRI_MIN; pri--)
+    if (!list_empty (&ready_queues[pri]))
+      list_splice (list_end (&pending), list_begin (&ready_queues[pri]),
+                   list_end (&ready_queues[pri]));
+  ready_mask = 0;
+  ready_cnt = 0;
+  while (!list_empty (&pending)) 
+    {
+      struct thread *t = list_entry (list_pop_front (&pending),
+                                     struct thread, elem);
+      mlfqs_catch_up (t);
+      t->priority = mlfqs_priority (t);
+      ready_push (t);
+    }
+
+  elapsed = timer_cycles () - start;
+  mlfqs_updates++;
+  mlfqs_update_cycles += elapsed;
+  if (elapsed > mlfqs_update_max)
+    mlfqs_update_max = elapsed;
+}
+
+/* Applies to T's recent_cpu the once-per-second decays that it
+   missed while it was blocked. */
+static void
+mlfqs_catch_up (struct thread *t) 
+{
+  if (mlfqs_epoch - t->cpu_epoch > DECAY_HISTORY)
+    t->cpu_epoch = mlfqs_epoch - DECAY_HISTORY;
+  for (; t->cpu_epoch < mlfqs_epoch; t->cpu_epoch++)
+    {
+      fixed_point_t decay = decay_history[t->cpu_epoch & (DECAY_HISTORY - 1)];
+      t->recent_cpu = fp_add_int (fp_mul (decay, t->recent_cpu), t->nice);
+    }
+}
+
+/* Returns T's priority as computed by the multi-level feedback
+   queue scheduler from its recent_cpu and nice values. */
+static int
+mlfqs_priority (const struct thread *t) 
+{
+  int priority = PRI_MAX - fp_trunc (t->recent_cpu / 4) - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  if (priority > PRI_MAX)
+    return PRI_MAX;
+  return priority;
+}
+
 /* Offset of `stack' member within `struct thread'.
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
@@ -2,8 +2,11 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <heap.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
+#include "threads/malloc.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -24,6 +27,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the multi-level feedback queue scheduler. */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -87,17 +95,46 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Priority, including donations. */
+    int base_priority;                  /* Priority before donations. */
     struct list_elem allelem;           /* List element for all threads list. */
-    int64_t wake_tm; /* The thread wake time */
+    int64_t wake_tm;                    /* Tick to wake up at, if sleeping. */
+    int nice;                           /* Niceness, for the MLFQS. */
+    fixed_point_t recent_cpu;           /* Recent CPU use, for the MLFQS. */
+    int64_t cpu_epoch;                  /* Second `recent_cpu' is as of. */
+
+    /* Scheduling statistics, owned by thread.c. */
+    int64_t run_ticks;                  /* Timer ticks spent running. */
+    unsigned voluntary_switches;        /* Blocks and yields. */
+    unsigned involuntary_switches;      /* Preemptions. */
+    uint64_t ready_cycles;              /* Cycles spent ready. */
+    uint64_t blocked_cycles;            /* Cycles spent blocked. */
+    uint64_t max_wakeup_latency;        /* Longest unblock-to-run, in cycles. */
+    uint64_t status_cycles;             /* timer_cycles() at last change. */
+    bool woken;                         /* Ready because of thread_unblock()? */
+
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct heap_elem wait_elem;         /* Element in a waiters heap. */
+    struct heap *wait_heap;             /* Waiters heap we are in, if any. */
+    unsigned wait_seq;                  /* Orders waiters of equal priority. */
+    struct lock *wait_lock;             /* Lock we are waiting for, if any. */
+    struct list held_locks;             /* Locks we hold. */
+
+    /* Owned by malloc.c. */
+    struct magazine magazines[MAGAZINE_CNT]; /* Cached free blocks. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
 #endif
 
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal_begin(). */
+    int journal_left;                   /* Unused share of transaction. */
+#endif
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -107,11 +144,17 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, dump the per-thread scheduling statistics and the
+   recent thread switches at shutdown and on kernel panic.
+   Controlled by kernel command-line option "-schedtrace". */
+extern bool thread_sched_trace;
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+void thread_print_trace (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -125,6 +168,8 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (void);
+void thread_yield_to_higher (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -132,6 +177,8 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate_priority (struct thread *, int);
+void thread_update_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);